@@ -0,0 +1,51 @@
+#pragma once
+
+#include "squirm.h"
+#include "types.h"
+
+// blitter registers. addresses, lengths and strides are 16 bits wide and stored like `sti`
+// stores them, high byte first.
+#define WT_BLITTER_REG_START 0x7f10
+#define WT_BLITTER_REG_COUNT 0x10
+#define WT_BLITTER_REG_SRC 0x0
+#define WT_BLITTER_REG_DEST 0x2
+#define WT_BLITTER_REG_LEN 0x4         // bytes to copy or fill, or the width of a rect
+#define WT_BLITTER_REG_HEIGHT 0x6      // rows of a rect
+#define WT_BLITTER_REG_SRC_STRIDE 0x8  // bytes from one source row of a rect to the next
+#define WT_BLITTER_REG_DEST_STRIDE 0xa // bytes from one dest row of a rect to the next
+#define WT_BLITTER_REG_FILL 0xc        // fills use the low byte
+#define WT_BLITTER_REG_MODE 0xe        // `WT_BLITTER_MODE_*` flags
+#define WT_BLITTER_REG_CONTROL 0xf     // writing WT_BLITTER_CONTROL_GO runs the blit
+
+// fill dest with the fill byte instead of copying from source
+#define WT_BLITTER_MODE_FILL 0x01
+// work on a rect of `height` rows instead of a single run of bytes
+#define WT_BLITTER_MODE_RECT 0x02
+
+#define WT_BLITTER_CONTROL_GO 0x01
+
+// bytes the blitter moves in the time the CPU runs one instruction
+#define WT_BLITTER_BYTES_PER_OP 16
+
+// a DMA device moving memory natively, through MMIO entries where they apply. blits run to
+// completion when started, and their cost is charged to the frame budget.
+typedef struct wormotron_blitter {
+    squirm_cpu_t* cpu;
+
+    u8 regs[WT_BLITTER_REG_COUNT];
+    bool busy; // a blit is running, so it can't start another one by writing the registers
+
+    u64 cost; // instructions owed to the frame budget, see `wormotron_blitter_take_cost`
+
+    // copies go through here, so overlapping ranges behave like `memmove`
+    u8 buffer[SQUIRM_MEM_SIZE];
+} wormotron_blitter_t;
+
+wormotron_blitter_t* wormotron_blitter_new(squirm_cpu_t* cpu);
+void wormotron_blitter_free(wormotron_blitter_t* blitter);
+
+void wormotron_blitter_write_reg(wormotron_blitter_t* blitter, u8 reg, u8 value);
+u8 wormotron_blitter_read_reg(wormotron_blitter_t* blitter, u8 reg);
+
+void wormotron_blitter_run(wormotron_blitter_t* blitter);
+u64 wormotron_blitter_take_cost(wormotron_blitter_t* blitter);
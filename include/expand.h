@@ -0,0 +1,39 @@
+#pragma once
+
+#include "types.h"
+
+#include "SDL_pixels.h"
+
+// expansion of packed 4bpp graphics RAM into RGBA texture rows.
+//
+// two pixels share a byte, the high nibble being the left one. the palette is kept both as
+// colors and as one 16-byte table per channel, so SIMD shuffles can look up 16 or 32 pixels
+// at once.
+
+typedef struct wormotron_expand_lut {
+    SDL_Color colors[16];
+    u8 r[16];
+    u8 g[16];
+    u8 b[16];
+    u8 a[16];
+} wormotron_expand_lut_t;
+
+// expands `len` packed bytes from `src` into `len * 2` pixels at `dst`
+typedef void (*wormotron_expand_fn)(
+    SDL_Color* dst,
+    const u8* src,
+    usize len,
+    const wormotron_expand_lut_t* lut
+);
+
+void wormotron_expand_lut_set(wormotron_expand_lut_t* lut, const SDL_Color palette[16]);
+
+void wormotron_expand_scalar(
+    SDL_Color* dst,
+    const u8* src,
+    usize len,
+    const wormotron_expand_lut_t* lut
+);
+
+// picks the fastest expansion the host CPU supports
+wormotron_expand_fn wormotron_expand_select(void);
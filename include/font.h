@@ -0,0 +1,12 @@
+#pragma once
+
+#include "types.h"
+
+// built-in 5x7 font for the text mode, covering printable ASCII
+
+#define WT_FONT_WIDTH 5
+#define WT_FONT_HEIGHT 7
+
+// returns the columns of the glyph for `c`, left to right, the top row in bit 0.
+// characters without a glyph are blank.
+const u8* wormotron_font_glyph(u8 c);
@@ -1,6 +1,7 @@
 #pragma once
 
-#include "SDL_mutex.h"
+#include "SDL_atomic.h"
+#include "expand.h"
 #include "types.h"
 
 #include "SDL.h"
@@ -22,8 +23,68 @@
 #define WT_GRAPHICS_PALETTE_START WT_GRAPHICS_RAM_SIZE - (16 * 4)
 #define WT_GRAPHICS_PALETTE_END WT_GRAPHICS_RAM_SIZE
 
+// the 4bpp framebuffer at the start of graphics RAM, drawn in raw mode
+#define WT_GRAPHICS_ROW_SIZE (WT_WINDOW_LOGICAL_WIDTH / 2)
+#define WT_GRAPHICS_FRAMEBUFFER_SIZE (WT_GRAPHICS_ROW_SIZE * WT_WINDOW_LOGICAL_HEIGHT)
+
+// 24x12 cells of 6x8 pixels, drawn in text mode over the start of the framebuffer: one
+// character per cell, then one color byte per cell with the background in the high nibble
+// and the foreground in the low one. a color byte of 0 uses the default colors.
+#define WT_GRAPHICS_TEXT_START 0x0000
+#define WT_GRAPHICS_TEXT_COLUMNS 24
+#define WT_GRAPHICS_TEXT_ROWS 12
+#define WT_GRAPHICS_TEXT_CELLS (WT_GRAPHICS_TEXT_COLUMNS * WT_GRAPHICS_TEXT_ROWS)
+#define WT_GRAPHICS_TEXT_COLORS_START (WT_GRAPHICS_TEXT_START + WT_GRAPHICS_TEXT_CELLS)
+#define WT_GRAPHICS_TEXT_CELL_WIDTH 6
+#define WT_GRAPHICS_TEXT_CELL_HEIGHT 8
+#define WT_GRAPHICS_TEXT_DEFAULT_COLORS 0x03
+// glyphs are cached for the 128 ASCII characters only, the rest draw blank
+#define WT_GRAPHICS_GLYPH_COUNT 128
+#define WT_GRAPHICS_GLYPH_PIXELS (WT_GRAPHICS_TEXT_CELL_WIDTH * WT_GRAPHICS_TEXT_CELL_HEIGHT)
+
+// a 32x32 map of tile indices, drawn in tiled mode. its 256x256 pixels wrap around when
+// scrolled.
+#define WT_GRAPHICS_TILEMAP_START 0x1b00
+#define WT_GRAPHICS_TILEMAP_WIDTH 32
+#define WT_GRAPHICS_TILEMAP_HEIGHT 32
+#define WT_GRAPHICS_TILEMAP_SIZE (WT_GRAPHICS_TILEMAP_WIDTH * WT_GRAPHICS_TILEMAP_HEIGHT)
+
+// 256 tiles of 8x8 pixels, packed like the framebuffer
+#define WT_GRAPHICS_TILE_START 0x1f00
+#define WT_GRAPHICS_TILE_COUNT 256
+#define WT_GRAPHICS_TILE_WIDTH 8
+#define WT_GRAPHICS_TILE_PIXELS (WT_GRAPHICS_TILE_WIDTH * WT_GRAPHICS_TILE_WIDTH)
+#define WT_GRAPHICS_TILE_SIZE (WT_GRAPHICS_TILE_PIXELS / 2)
+
+// 48 sprites of 4 bytes each: x, y, tile and flags. sprites are drawn over the tilemap in
+// tiled mode and over palette color 0 in sprite-only mode, the first sprite on top.
+#define WT_GRAPHICS_SPRITE_START 0x3f00
+#define WT_GRAPHICS_SPRITE_COUNT 48
+#define WT_GRAPHICS_SPRITE_SIZE 4
+// a sprite at x, y covers the screen from x - 8, y - 8, so it can move in from the edges
+#define WT_GRAPHICS_SPRITE_OFFSET 8
+
+#define WT_GRAPHICS_SPRITE_VISIBLE 0x01
+#define WT_GRAPHICS_SPRITE_FLIP_X 0x02
+#define WT_GRAPHICS_SPRITE_FLIP_Y 0x04
+// the high nibble of the flags is added to each color index. index 0 is transparent.
+#define WT_GRAPHICS_SPRITE_PALETTE_SHIFT 4
+
+// graphics registers, mapped on their own since they aren't part of graphics RAM
+#define WT_GRAPHICS_REG_START 0x7f00
+#define WT_GRAPHICS_REG_COUNT 0x10
+#define WT_GRAPHICS_REG_MODE 0x0     // a `wormotron_graphics_mode_t`
+#define WT_GRAPHICS_REG_SCROLL_X 0x1 // tilemap pixel drawn at the left edge
+#define WT_GRAPHICS_REG_SCROLL_Y 0x2 // tilemap pixel drawn at the top edge
+
 #define WT_GRAPHICS_MAX_COMMANDS 4096
 
+// completed frames are handed from the CPU thread to the render thread through a triple
+// buffer: one frame being published, one being drawn, and one in between
+#define WT_GRAPHICS_FRAME_COUNT 3
+#define WT_GRAPHICS_FRAME_INDEX 0x3
+#define WT_GRAPHICS_FRAME_FRESH 0x4
+
 typedef enum wormotron_graphics_mode {
     WT_GRAPHICS_MODE_RAW,
     WT_GRAPHICS_MODE_TEXT,
@@ -36,54 +97,115 @@ typedef struct wormotron_graphics_command {
     u8 value;
 } wormotron_graphics_command_t;
 
+typedef enum wormotron_graphics_dump_format {
+    WT_GRAPHICS_DUMP_PPM, // binary PPM, RGB without alpha
+    WT_GRAPHICS_DUMP_RAW, // RGBA bytes, row by row
+} wormotron_graphics_dump_format_t;
+
+// what changed in graphics RAM since some earlier frame
+typedef struct wormotron_graphics_dirty {
+    u64 rows[(WT_WINDOW_LOGICAL_HEIGHT + 63) / 64];
+    u64 tiles[WT_GRAPHICS_TILE_COUNT / 64];
+    bool tilemap;
+    bool sprites;
+    bool regs;
+    bool palette;
+} wormotron_graphics_dirty_t;
+
 typedef struct wormotron_graphics {
+    // headless graphics have no window and render into `pixels` instead of the texture
+    bool headless;
+
     SDL_Window* window;
     SDL_Renderer* renderer;
     SDL_Texture* texture;
+    SDL_Color pixels[WT_WINDOW_LOGICAL_WIDTH * WT_WINDOW_LOGICAL_HEIGHT];
 
+    // what the render thread drew last
     wormotron_graphics_mode_t mode;
 
     SDL_Color palette[WT_GRAPHICS_PALETTE_SIZE];
+    bool palette_loaded; // whether `palette` was loaded from a frame yet
+
+    wormotron_expand_fn expand;
+    wormotron_expand_lut_t lut;
 
-    SDL_mutex* mutex;
+    // expanded tiles, only expanded again once they're stale
+    SDL_Color tile_cache[WT_GRAPHICS_TILE_COUNT][WT_GRAPHICS_TILE_PIXELS];
+    u64 tile_stale[WT_GRAPHICS_TILE_COUNT / 64];
 
+    // glyphs rasterized for each color byte, allocated on first use. palette changes make
+    // all of them stale.
+    SDL_Color* glyph_cache[256];
+    u64 glyph_stale[256 / 64];
+
+    // only touched by the CPU thread
     u8 ram[WT_GRAPHICS_RAM_SIZE];
+    u8 regs[WT_GRAPHICS_REG_COUNT];
+    wormotron_graphics_dirty_t dirty; // changes since the last published frame
+    wormotron_graphics_dirty_t undrawn; // changes the render thread may not have drawn
+
+    // snapshots of `ram`, see `wormotron_graphics_publish`
+    u8 frames[WT_GRAPHICS_FRAME_COUNT][WT_GRAPHICS_RAM_SIZE];
+    u8 frame_regs[WT_GRAPHICS_FRAME_COUNT][WT_GRAPHICS_REG_COUNT];
+    // changes of each frame against the last one the render thread drew
+    wormotron_graphics_dirty_t frame_dirty[WT_GRAPHICS_FRAME_COUNT];
+    u8 back;  // frame the CPU thread fills next
+    u8 front; // frame the render thread draws
+    // frame in between, with WT_GRAPHICS_FRAME_FRESH set until the render thread takes it
+    SDL_atomic_t ready;
 } wormotron_graphics_t;
 
-wormotron_graphics_t* wormotron_graphics_new(void);
+wormotron_graphics_t* wormotron_graphics_new(bool headless);
 void wormotron_graphics_free(wormotron_graphics_t* graphics);
 
 void wormotron_graphics_clear(wormotron_graphics_t* graphics);
 void wormotron_graphics_flush(wormotron_graphics_t* graphics);
 void wormotron_graphics_present(wormotron_graphics_t* graphics);
 
+void wormotron_graphics_publish(wormotron_graphics_t* graphics);
+bool wormotron_graphics_acquire(wormotron_graphics_t* graphics);
+bool wormotron_graphics_pending(wormotron_graphics_t* graphics);
+
+void wormotron_graphics_dump(
+    wormotron_graphics_t* graphics,
+    const char* path,
+    wormotron_graphics_dump_format_t format
+);
+
+void wormotron_graphics_mark(wormotron_graphics_t* graphics, u16 address, u16 len);
 void wormotron_graphics_write(wormotron_graphics_t* graphics, u16 address, u8 value);
 u8 wormotron_graphics_read(wormotron_graphics_t* graphics, u16 address);
-// void wormotron_graphics_set_mode(
-//     wormotron_graphics_t* graphics,
-//     wormotron_graphics_mode_t mode
-// );
+void wormotron_graphics_write16(wormotron_graphics_t* graphics, u16 address, u16 value);
+u16 wormotron_graphics_read16(wormotron_graphics_t* graphics, u16 address);
+void wormotron_graphics_write_range(
+    wormotron_graphics_t* graphics,
+    u16 address,
+    const u8* data,
+    u16 len
+);
+void wormotron_graphics_read_range(
+    wormotron_graphics_t* graphics,
+    u16 address,
+    u8* data,
+    u16 len
+);
+void wormotron_graphics_write_reg(wormotron_graphics_t* graphics, u8 reg, u8 value);
+u8 wormotron_graphics_read_reg(wormotron_graphics_t* graphics, u8 reg);
+
+void wormotron_graphics_set_mode(
+    wormotron_graphics_t* graphics,
+    wormotron_graphics_mode_t mode
+);
 void wormotron_graphics_draw_pixel(wormotron_graphics_t* graphics, u8 x, u8 y, u8 color);
-// void wormotron_graphics_draw_sprite(wormotron_graphics_t* graphics, u8 x, u8 y, u8* sprite);
-// void wormotron_graphics_draw_sprite_flip_x(
-//     wormotron_graphics_t* graphics,
-//     u8 x,
-//     u8 y,
-//     u8* sprite
-// );
-// void wormotron_graphics_draw_sprite_flip_y(
-//     wormotron_graphics_t* graphics,
-//     u8 x,
-//     u8 y,
-//     u8* sprite
-// );
-//
-// void wormotron_graphics_draw_sprite_flip_xy(
-//     wormotron_graphics_t* graphics,
-//     u8 x,
-//     u8 y,
-//     u8* sprite
-// );
+void wormotron_graphics_set_sprite(
+    wormotron_graphics_t* graphics,
+    u8 sprite,
+    u8 x,
+    u8 y,
+    u8 tile,
+    u8 flags
+);
 // void wormotron_graphics_set_palette(wormotron_graphics_t* graphics, SDL_Color* palette);
 // void wormotron_graphics_set_palette_color_rgb(
 //     wormotron_graphics_t* graphics,
@@ -92,13 +214,11 @@ void wormotron_graphics_draw_pixel(wormotron_graphics_t* graphics, u8 x, u8 y, u
 //     u8 g,
 //     u8 b
 // );
-// void wormotron_graphics_set_tile(
-//     wormotron_graphics_t* graphics,
-//     u8 tilemap,
-//     u8 x,
-//     u8 y,
-//     u8 tile_data[64]
-// );
-// void wormotron_graphics_put_tile(wormotron_graphics_t* graphics, u8 layer, u8 x, u8 y, u8
-// tile); void wormotron_graphics_set_tilemap(wormotron_graphics_t* graphics, u8 layer, u8
-// tilemap);
+void wormotron_graphics_set_tile(
+    wormotron_graphics_t* graphics,
+    u8 tile,
+    const u8 tile_data[WT_GRAPHICS_TILE_SIZE]
+);
+void wormotron_graphics_put_tile(wormotron_graphics_t* graphics, u8 x, u8 y, u8 tile);
+void wormotron_graphics_set_scroll(wormotron_graphics_t* graphics, u8 x, u8 y);
+void wormotron_graphics_put_char(wormotron_graphics_t* graphics, u8 x, u8 y, u8 c, u8 colors);
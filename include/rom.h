@@ -2,10 +2,16 @@
 
 #include "types.h"
 
+// ROMs with this extension are `weave` sources, and get assembled when they're loaded
+#define WT_ROM_SOURCE_EXTENSION ".wev"
+
 typedef struct wormotron_rom {
     u8* data;
     u16 size;
 } wormotron_rom_t;
 
+bool wormotron_rom_is_source(const char* rom_file);
+
 wormotron_rom_t* wormotron_rom_load(const char* rom_file);
+wormotron_rom_t* wormotron_rom_assemble(const char* source_file);
 void wormotron_rom_free(wormotron_rom_t* rom);
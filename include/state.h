@@ -0,0 +1,36 @@
+#pragma once
+
+#include "blitter.h"
+#include "graphics.h"
+#include "squirm.h"
+#include "types.h"
+#include "wormotron.h"
+
+// save state files start with the magic, then the version of their layout
+#define WT_STATE_MAGIC "WTST"
+#define WT_STATE_VERSION 1
+
+// graphics RAM is saved in pages, only keeping the ones that aren't all zeros
+#define WT_STATE_GRAPHICS_PAGE_SIZE 0x100
+#define WT_STATE_GRAPHICS_PAGE_COUNT (WT_GRAPHICS_RAM_SIZE / WT_STATE_GRAPHICS_PAGE_SIZE)
+
+// the state of the whole machine between two frames. the palette lives in graphics RAM and
+// the mode in the graphics registers. CPU memory is kept as pages that differ from the ROM,
+// so states of the same program are cheap to capture and to restore.
+typedef struct wormotron_state {
+    squirm_snapshot_t* cpu;
+    u8 graphics_ram[WT_GRAPHICS_RAM_SIZE];
+    u8 graphics_regs[WT_GRAPHICS_REG_COUNT];
+    u8 blitter_regs[WT_BLITTER_REG_COUNT];
+} wormotron_state_t;
+
+wormotron_state_t* wormotron_state_capture(wormotron_t* wormotron);
+void wormotron_state_restore(wormotron_t* wormotron, const wormotron_state_t* state);
+void wormotron_state_free(wormotron_state_t* state);
+
+void wormotron_state_save(
+    const wormotron_t* wormotron,
+    const wormotron_state_t* state,
+    const char* path
+);
+wormotron_state_t* wormotron_state_load(const wormotron_t* wormotron, const char* path);
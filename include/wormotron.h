@@ -1,11 +1,15 @@
 #pragma once
 
+#include "SDL_atomic.h"
 #include "SDL_mutex.h"
+#include "blitter.h"
 #include "graphics.h"
 #include "squirm.h"
 #include "types.h"
 #include "rom.h"
 
+#include <signal.h>
+
 #define WT_WINDOW_TITLE "dev: wormotron"
 #define WT_WINDOW_LOGICAL_WIDTH 144
 #define WT_WINDOW_LOGICAL_HEIGHT 96
@@ -13,17 +17,57 @@
 #define WT_WINDOW_WIDTH (WT_WINDOW_LOGICAL_WIDTH * WT_WINDOW_SCALE)
 #define WT_WINDOW_HEIGHT (WT_WINDOW_LOGICAL_HEIGHT * WT_WINDOW_SCALE)
 
-extern bool g_stop;
+// default for how many instructions make up one frame of the virtual clock
+#define WT_CPU_OPS_PER_FRAME 0x100000
+
+// frames per second the virtual clock is paced to
+#define WT_FRAME_RATE 60
+
+// frames between checks whether a watched source changed
+#define WT_WATCH_INTERVAL (WT_FRAME_RATE / 4)
+
+// set by either thread to stop both
+extern SDL_atomic_t g_stop;
+
+// only set by the signal handlers, the main thread forwards it to `g_stop`
+extern volatile sig_atomic_t g_signal_stop;
+
+typedef struct wormotron_config {
+    u32 ops_per_frame;
+
+    // headless runs render every frame into memory, as fast as the CPU allows
+    bool headless;
+    u64 frame_limit; // stop after this many frames, 0 runs until the program exits
+    u32 dump_every;  // dump every nth frame, 0 never dumps
+    const char* dump_dir;
+    wormotron_graphics_dump_format_t dump_format;
+
+    const char* load_state; // save state to resume from, NULL boots the ROM
+    const char* save_state; // where to save the state on exit, NULL doesn't save
+
+    // reassembles a `.wev` ROM and restarts it whenever its source changes
+    bool watch;
+} wormotron_config_t;
 
 typedef struct wormotron {
     wormotron_graphics_t* graphics;
+    wormotron_blitter_t* blitter;
     squirm_cpu_t* cpu;
     wormotron_rom_t* rom;
+    const char* rom_file;
+
+    // when the watched source last changed, only touched by the CPU thread
+    i64 rom_mtime;
+    i64 rom_file_size;
+
+    wormotron_config_t config;
+
+    bool wait_for_present; // set by the program's syscall, only touched by the CPU thread
 } wormotron_t;
 
-extern wormotron_t* g_wormotron;
+wormotron_config_t wormotron_config_default(void);
 
-wormotron_t* wormotron_new(const char* rom_file);
+wormotron_t* wormotron_new(const char* rom_file, const wormotron_config_t* config);
 void wormotron_free(wormotron_t* wormotron);
 
 void wormotron_run(wormotron_t* wormotron);
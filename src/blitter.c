@@ -0,0 +1,119 @@
+#include "blitter.h"
+
+#include "log.h"
+#include "squirm.h"
+#include "types.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+wormotron_blitter_t* wormotron_blitter_new(squirm_cpu_t* cpu) {
+    wormotron_blitter_t* blitter = malloc(sizeof(wormotron_blitter_t));
+
+    if (blitter == NULL) {
+        LOG_ERROR("Failed to allocate memory for blitter\n");
+        exit(1);
+    }
+
+    blitter->cpu = cpu;
+    memset(blitter->regs, 0, sizeof(blitter->regs));
+    blitter->busy = false;
+    blitter->cost = 0;
+
+    return blitter;
+}
+
+void wormotron_blitter_free(wormotron_blitter_t* blitter) {
+    free(blitter);
+}
+
+static u16 wormotron_blitter_reg16(wormotron_blitter_t* blitter, u8 reg) {
+    return (u16)((blitter->regs[reg] << 8) | blitter->regs[reg + 1]);
+}
+
+void wormotron_blitter_write_reg(wormotron_blitter_t* blitter, u8 reg, u8 value) {
+    assert(reg < WT_BLITTER_REG_COUNT);
+
+    blitter->regs[reg] = value;
+
+    if (reg == WT_BLITTER_REG_CONTROL && (value & WT_BLITTER_CONTROL_GO)) {
+        wormotron_blitter_run(blitter);
+    }
+}
+
+u8 wormotron_blitter_read_reg(wormotron_blitter_t* blitter, u8 reg) {
+    assert(reg < WT_BLITTER_REG_COUNT);
+
+    return blitter->regs[reg];
+}
+
+// copies or fills a single run of `len` bytes
+static void wormotron_blitter_run_line(
+    wormotron_blitter_t* blitter,
+    u16 src,
+    u16 dest,
+    u16 len,
+    bool fill
+) {
+    if (fill) {
+        memset(blitter->buffer, blitter->regs[WT_BLITTER_REG_FILL + 1], len);
+    } else {
+        squirm_cpu_read_range(blitter->cpu, src, blitter->buffer, len);
+    }
+
+    squirm_cpu_write_range(blitter->cpu, dest, blitter->buffer, len);
+}
+
+// runs the blit the registers describe. the go bit is cleared once it's done.
+void wormotron_blitter_run(wormotron_blitter_t* blitter) {
+    if (blitter->busy) {
+        return;
+    }
+
+    blitter->busy = true;
+
+    u8 mode = blitter->regs[WT_BLITTER_REG_MODE];
+    bool fill = (mode & WT_BLITTER_MODE_FILL) != 0;
+    u16 src = wormotron_blitter_reg16(blitter, WT_BLITTER_REG_SRC);
+    u16 dest = wormotron_blitter_reg16(blitter, WT_BLITTER_REG_DEST);
+    u16 len = wormotron_blitter_reg16(blitter, WT_BLITTER_REG_LEN);
+    u32 bytes = len;
+
+    if (mode & WT_BLITTER_MODE_RECT) {
+        u16 height = wormotron_blitter_reg16(blitter, WT_BLITTER_REG_HEIGHT);
+        u16 src_stride = wormotron_blitter_reg16(blitter, WT_BLITTER_REG_SRC_STRIDE);
+        u16 dest_stride = wormotron_blitter_reg16(blitter, WT_BLITTER_REG_DEST_STRIDE);
+
+        // when moving a rect down, copy its last row first so overlapping rows are read
+        // before they're overwritten
+        bool reverse = !fill && dest > src;
+
+        for (u16 i = 0; i < height; i++) {
+            u16 row = reverse ? (u16)(height - 1 - i) : i;
+
+            wormotron_blitter_run_line(
+                blitter,
+                (u16)(src + row * src_stride),
+                (u16)(dest + row * dest_stride),
+                len,
+                fill
+            );
+        }
+
+        bytes *= height;
+    } else {
+        wormotron_blitter_run_line(blitter, src, dest, len, fill);
+    }
+
+    blitter->cost += 1 + bytes / WT_BLITTER_BYTES_PER_OP;
+    blitter->regs[WT_BLITTER_REG_CONTROL] &= (u8)~WT_BLITTER_CONTROL_GO;
+    blitter->busy = false;
+}
+
+// returns the instructions blits cost since the last call
+u64 wormotron_blitter_take_cost(wormotron_blitter_t* blitter) {
+    u64 cost = blitter->cost;
+    blitter->cost = 0;
+    return cost;
+}
@@ -0,0 +1,165 @@
+#include "expand.h"
+
+#include "log.h"
+#include "types.h"
+
+#include "SDL_cpuinfo.h"
+#include "SDL_pixels.h"
+
+// the SIMD paths are compiled with per-function target attributes and picked at runtime, so
+// the rest of the build doesn't need any extra instruction set flags
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define WT_EXPAND_X86
+#include <immintrin.h>
+#endif
+
+void wormotron_expand_lut_set(wormotron_expand_lut_t* lut, const SDL_Color palette[16]) {
+    for (u8 i = 0; i < 16; i++) {
+        lut->colors[i] = palette[i];
+        lut->r[i] = palette[i].r;
+        lut->g[i] = palette[i].g;
+        lut->b[i] = palette[i].b;
+        lut->a[i] = palette[i].a;
+    }
+}
+
+void wormotron_expand_scalar(
+    SDL_Color* dst,
+    const u8* src,
+    usize len,
+    const wormotron_expand_lut_t* lut
+) {
+    for (usize i = 0; i < len; i++) {
+        dst[i * 2] = lut->colors[src[i] >> 4];
+        dst[i * 2 + 1] = lut->colors[src[i] & 0x0f];
+    }
+}
+
+#ifdef WT_EXPAND_X86
+
+// looks up 16 palette indices and stores the 16 resulting pixels
+__attribute__((target("ssse3"))) static inline void wormotron_expand_store16(
+    SDL_Color* dst,
+    __m128i idx,
+    const wormotron_expand_lut_t* lut
+) {
+    __m128i r = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)lut->r), idx);
+    __m128i g = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)lut->g), idx);
+    __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)lut->b), idx);
+    __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)lut->a), idx);
+
+    __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+    __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+    __m128i ba_lo = _mm_unpacklo_epi8(b, a);
+    __m128i ba_hi = _mm_unpackhi_epi8(b, a);
+
+    _mm_storeu_si128((__m128i*)dst + 0, _mm_unpacklo_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128((__m128i*)dst + 1, _mm_unpackhi_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128((__m128i*)dst + 2, _mm_unpacklo_epi16(rg_hi, ba_hi));
+    _mm_storeu_si128((__m128i*)dst + 3, _mm_unpackhi_epi16(rg_hi, ba_hi));
+}
+
+__attribute__((target("ssse3"))) static void wormotron_expand_ssse3(
+    SDL_Color* dst,
+    const u8* src,
+    usize len,
+    const wormotron_expand_lut_t* lut
+) {
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    usize i = 0;
+
+    // 16 bytes, 32 pixels at a time
+    for (; i + 16 <= len; i += 16) {
+        __m128i packed = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(packed, 4), mask);
+        __m128i lo = _mm_and_si128(packed, mask);
+
+        wormotron_expand_store16(dst + i * 2, _mm_unpacklo_epi8(hi, lo), lut);
+        wormotron_expand_store16(dst + i * 2 + 16, _mm_unpackhi_epi8(hi, lo), lut);
+    }
+
+    // rows are 72 bytes wide, so a half vector usually finishes them
+    if (i + 8 <= len) {
+        __m128i packed = _mm_loadl_epi64((const __m128i*)(src + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(packed, 4), mask);
+        __m128i lo = _mm_and_si128(packed, mask);
+
+        wormotron_expand_store16(dst + i * 2, _mm_unpacklo_epi8(hi, lo), lut);
+        i += 8;
+    }
+
+    wormotron_expand_scalar(dst + i * 2, src + i, len - i, lut);
+}
+
+__attribute__((target("avx2"))) static void wormotron_expand_avx2(
+    SDL_Color* dst,
+    const u8* src,
+    usize len,
+    const wormotron_expand_lut_t* lut
+) {
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    const __m256i r_lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)lut->r));
+    const __m256i g_lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)lut->g));
+    const __m256i b_lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)lut->b));
+    const __m256i a_lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)lut->a));
+    usize i = 0;
+
+    // 32 bytes, 64 pixels at a time
+    for (; i + 32 <= len; i += 32) {
+        __m256i packed = _mm256_loadu_si256((const __m256i*)(src + i));
+
+        // shuffles and unpacks stay within 128-bit lanes, so spread the input such that the
+        // unpacked indices come out in pixel order across both lanes
+        packed = _mm256_permute4x64_epi64(packed, 0xd8);
+
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(packed, 4), mask);
+        __m256i lo = _mm256_and_si256(packed, mask);
+        __m256i idx[2] = { _mm256_unpacklo_epi8(hi, lo), _mm256_unpackhi_epi8(hi, lo) };
+
+        for (int half = 0; half < 2; half++) {
+            __m256i r = _mm256_shuffle_epi8(r_lut, idx[half]);
+            __m256i g = _mm256_shuffle_epi8(g_lut, idx[half]);
+            __m256i b = _mm256_shuffle_epi8(b_lut, idx[half]);
+            __m256i a = _mm256_shuffle_epi8(a_lut, idx[half]);
+
+            __m256i rg_lo = _mm256_unpacklo_epi8(r, g);
+            __m256i rg_hi = _mm256_unpackhi_epi8(r, g);
+            __m256i ba_lo = _mm256_unpacklo_epi8(b, a);
+            __m256i ba_hi = _mm256_unpackhi_epi8(b, a);
+
+            __m256i p0 = _mm256_unpacklo_epi16(rg_lo, ba_lo);
+            __m256i p1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);
+            __m256i p2 = _mm256_unpacklo_epi16(rg_hi, ba_hi);
+            __m256i p3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);
+
+            __m256i* out = (__m256i*)(dst + i * 2 + half * 32);
+            _mm256_storeu_si256(out + 0, _mm256_permute2x128_si256(p0, p1, 0x20));
+            _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(p2, p3, 0x20));
+            _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(p0, p1, 0x31));
+            _mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+        }
+    }
+
+    // the tail runs legacy SSE code, which stalls on dirty upper halves of the AVX registers
+    _mm256_zeroupper();
+    wormotron_expand_ssse3(dst + i * 2, src + i, len - i, lut);
+}
+
+#endif
+
+wormotron_expand_fn wormotron_expand_select(void) {
+#ifdef WT_EXPAND_X86
+    if (SDL_HasAVX2()) {
+        LOG_DEBUG("Expanding graphics with AVX2.\n");
+        return wormotron_expand_avx2;
+    }
+
+    if (SDL_HasSSSE3()) {
+        LOG_DEBUG("Expanding graphics with SSSE3.\n");
+        return wormotron_expand_ssse3;
+    }
+#endif
+
+    LOG_DEBUG("Expanding graphics with the scalar fallback.\n");
+    return wormotron_expand_scalar;
+}
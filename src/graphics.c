@@ -1,7 +1,9 @@
 #include "graphics.h"
 
-#include "SDL_mutex.h"
+#include "SDL_atomic.h"
 #include "burrow.h"
+#include "expand.h"
+#include "font.h"
 #include "log.h"
 
 #include "SDL_pixels.h"
@@ -13,6 +15,8 @@
 #include "types.h"
 #include "wormotron.h"
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
 
 static const SDL_Color k_default_palette[16] = {
     { .r = 0x00, .g = 0x00, .b = 0x00, .a = 0xFF },
@@ -33,14 +37,8 @@ static const SDL_Color k_default_palette[16] = {
     { .r = 0xff, .g = 0xdd, .b = 0x34, .a = 0xFF },
 };
 
-wormotron_graphics_t* wormotron_graphics_new(void) {
-    wormotron_graphics_t* graphics = malloc(sizeof(wormotron_graphics_t));
-
-    if (graphics == NULL) {
-        LOG_ERROR("Failed to allocate memory for graphics\n");
-        exit(1);
-    }
-
+// opens the window and sets up the renderer and the streaming texture
+static void wormotron_graphics_open_window(wormotron_graphics_t* graphics) {
     // Initialize SDL. We will be using a software renderer.
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         LOG_ERROR("SDL initialization failed: %s\n", SDL_GetError());
@@ -93,14 +91,6 @@ wormotron_graphics_t* wormotron_graphics_new(void) {
         WT_WINDOW_LOGICAL_HEIGHT
     );
 
-    for (int i = 0; i < 16; i++) {
-        graphics->palette[i] = k_default_palette[i];
-        graphics->ram[WT_GRAPHICS_PALETTE_START + i * 4 + 0] = k_default_palette[i].r;
-        graphics->ram[WT_GRAPHICS_PALETTE_START + i * 4 + 1] = k_default_palette[i].g;
-        graphics->ram[WT_GRAPHICS_PALETTE_START + i * 4 + 2] = k_default_palette[i].b;
-        graphics->ram[WT_GRAPHICS_PALETTE_START + i * 4 + 3] = k_default_palette[i].a;
-    }
-
     // Create a texture.
     graphics->texture = SDL_CreateTexture(
         graphics->renderer,
@@ -116,8 +106,66 @@ wormotron_graphics_t* wormotron_graphics_new(void) {
     }
 
     LOG_DEBUG("Texture created.\n");
+}
 
-    graphics->mutex = SDL_CreateMutex();
+wormotron_graphics_t* wormotron_graphics_new(bool headless) {
+    wormotron_graphics_t* graphics = malloc(sizeof(wormotron_graphics_t));
+
+    if (graphics == NULL) {
+        LOG_ERROR("Failed to allocate memory for graphics\n");
+        exit(1);
+    }
+
+    graphics->headless = headless;
+
+    if (headless) {
+        // the CPU thread still relies on SDL's timers
+        if (SDL_Init(SDL_INIT_TIMER) != 0) {
+            LOG_ERROR("SDL initialization failed: %s\n", SDL_GetError());
+            exit(1);
+        }
+
+        graphics->window = NULL;
+        graphics->renderer = NULL;
+        graphics->texture = NULL;
+
+        LOG_DEBUG("Running headless.\n");
+    } else {
+        wormotron_graphics_open_window(graphics);
+    }
+
+    memset(graphics->ram, 0, sizeof(graphics->ram));
+
+    for (int i = 0; i < 16; i++) {
+        graphics->palette[i] = k_default_palette[i];
+        graphics->ram[WT_GRAPHICS_PALETTE_START + i * 4 + 0] = k_default_palette[i].r;
+        graphics->ram[WT_GRAPHICS_PALETTE_START + i * 4 + 1] = k_default_palette[i].g;
+        graphics->ram[WT_GRAPHICS_PALETTE_START + i * 4 + 2] = k_default_palette[i].b;
+        graphics->ram[WT_GRAPHICS_PALETTE_START + i * 4 + 3] = k_default_palette[i].a;
+    }
+
+    graphics->expand = wormotron_expand_select();
+
+    // the first frame drawn has to paint everything
+    graphics->palette_loaded = false;
+    graphics->dirty = (wormotron_graphics_dirty_t){ .palette = true };
+    graphics->undrawn = graphics->dirty;
+
+    memset(graphics->regs, 0, sizeof(graphics->regs));
+    graphics->mode = WT_GRAPHICS_MODE_RAW;
+    memset(graphics->tile_stale, 0xff, sizeof(graphics->tile_stale));
+    memset(graphics->glyph_cache, 0, sizeof(graphics->glyph_cache));
+    memset(graphics->glyph_stale, 0xff, sizeof(graphics->glyph_stale));
+
+    for (u8 i = 0; i < WT_GRAPHICS_FRAME_COUNT; i++) {
+        memcpy(graphics->frames[i], graphics->ram, sizeof(graphics->ram));
+        memcpy(graphics->frame_regs[i], graphics->regs, sizeof(graphics->regs));
+        graphics->frame_dirty[i] = graphics->dirty;
+    }
+
+    graphics->front = 0;
+    graphics->back = 1;
+    SDL_AtomicSet(&graphics->ready, 2);
 
     LOG_DEBUG("Graphics initialized.\n");
 
@@ -125,18 +173,69 @@ wormotron_graphics_t* wormotron_graphics_new(void) {
 }
 
 void wormotron_graphics_free(wormotron_graphics_t* graphics) {
-    SDL_DestroyTexture(graphics->texture);
-    SDL_DestroyRenderer(graphics->renderer);
-    SDL_DestroyWindow(graphics->window);
-    SDL_DestroyMutex(graphics->mutex);
+    if (!graphics->headless) {
+        SDL_DestroyTexture(graphics->texture);
+        SDL_DestroyRenderer(graphics->renderer);
+        SDL_DestroyWindow(graphics->window);
+    }
+
+    for (usize i = 0; i < 256; i++) {
+        free(graphics->glyph_cache[i]);
+    }
+
     SDL_Quit();
     free(graphics);
 }
 
+// records a write of `len` bytes at `address`, including writes made to `ram` directly
+void wormotron_graphics_mark(wormotron_graphics_t* graphics, u16 address, u16 len) {
+    u32 end = (u32)address + len;
+
+    if (address < WT_GRAPHICS_FRAMEBUFFER_SIZE) {
+        u32 fb_end = end < WT_GRAPHICS_FRAMEBUFFER_SIZE ? end : WT_GRAPHICS_FRAMEBUFFER_SIZE;
+        u32 first_row = address / WT_GRAPHICS_ROW_SIZE;
+        u32 last_row = (fb_end - 1) / WT_GRAPHICS_ROW_SIZE;
+
+        for (u32 row = first_row; row <= last_row; row++) {
+            graphics->dirty.rows[row / 64] |= 1ull << (row % 64);
+        }
+    }
+
+    if (address < WT_GRAPHICS_TILEMAP_START + WT_GRAPHICS_TILEMAP_SIZE &&
+        end > WT_GRAPHICS_TILEMAP_START) {
+        graphics->dirty.tilemap = true;
+    }
+
+    u32 tiles_end = WT_GRAPHICS_TILE_START + WT_GRAPHICS_TILE_COUNT * WT_GRAPHICS_TILE_SIZE;
+
+    if (address < tiles_end && end > WT_GRAPHICS_TILE_START) {
+        u32 first = address > WT_GRAPHICS_TILE_START ? address : WT_GRAPHICS_TILE_START;
+        u32 last = (end < tiles_end ? end : tiles_end) - 1;
+
+        for (u32 tile = (first - WT_GRAPHICS_TILE_START) / WT_GRAPHICS_TILE_SIZE;
+             tile <= (last - WT_GRAPHICS_TILE_START) / WT_GRAPHICS_TILE_SIZE;
+             tile++) {
+            graphics->dirty.tiles[tile / 64] |= 1ull << (tile % 64);
+        }
+    }
+
+    u32 sprites_end =
+        WT_GRAPHICS_SPRITE_START + WT_GRAPHICS_SPRITE_COUNT * WT_GRAPHICS_SPRITE_SIZE;
+
+    if (address < sprites_end && end > WT_GRAPHICS_SPRITE_START) {
+        graphics->dirty.sprites = true;
+    }
+
+    if (end > WT_GRAPHICS_PALETTE_START) {
+        graphics->dirty.palette = true;
+    }
+}
+
 void wormotron_graphics_write(wormotron_graphics_t* graphics, u16 address, u8 value) {
     assert(address < WT_GRAPHICS_RAM_SIZE);
 
     graphics->ram[address] = value;
+    wormotron_graphics_mark(graphics, address, 1);
 }
 
 u8 wormotron_graphics_read(wormotron_graphics_t* graphics, u16 address) {
@@ -145,52 +244,681 @@ u8 wormotron_graphics_read(wormotron_graphics_t* graphics, u16 address) {
     return graphics->ram[address];
 }
 
+// stores the high byte first, matching how squirm splits 16-bit MMIO stores
+void wormotron_graphics_write16(wormotron_graphics_t* graphics, u16 address, u16 value) {
+    assert(address + 1 < WT_GRAPHICS_RAM_SIZE);
+
+    graphics->ram[address] = (u8)(value >> 8);
+    graphics->ram[address + 1] = (u8)value;
+    wormotron_graphics_mark(graphics, address, 2);
+}
+
+// loads little-endian, matching how squirm combines 16-bit MMIO loads
+u16 wormotron_graphics_read16(wormotron_graphics_t* graphics, u16 address) {
+    assert(address + 1 < WT_GRAPHICS_RAM_SIZE);
+
+    return (u16)(graphics->ram[address] | (graphics->ram[address + 1] << 8));
+}
+
+void wormotron_graphics_write_range(
+    wormotron_graphics_t* graphics,
+    u16 address,
+    const u8* data,
+    u16 len
+) {
+    assert(address + len <= WT_GRAPHICS_RAM_SIZE);
+
+    memcpy(graphics->ram + address, data, len);
+    wormotron_graphics_mark(graphics, address, len);
+}
+
+void wormotron_graphics_read_range(
+    wormotron_graphics_t* graphics,
+    u16 address,
+    u8* data,
+    u16 len
+) {
+    assert(address + len <= WT_GRAPHICS_RAM_SIZE);
+
+    memcpy(data, graphics->ram + address, len);
+}
+
+void wormotron_graphics_write_reg(wormotron_graphics_t* graphics, u8 reg, u8 value) {
+    assert(reg < WT_GRAPHICS_REG_COUNT);
+
+    graphics->regs[reg] = value;
+    graphics->dirty.regs = true;
+}
+
+u8 wormotron_graphics_read_reg(wormotron_graphics_t* graphics, u8 reg) {
+    assert(reg < WT_GRAPHICS_REG_COUNT);
+
+    return graphics->regs[reg];
+}
+
+void wormotron_graphics_set_mode(
+    wormotron_graphics_t* graphics,
+    wormotron_graphics_mode_t mode
+) {
+    wormotron_graphics_write_reg(graphics, WT_GRAPHICS_REG_MODE, (u8)mode);
+}
+
+void wormotron_graphics_set_tile(
+    wormotron_graphics_t* graphics,
+    u8 tile,
+    const u8 tile_data[WT_GRAPHICS_TILE_SIZE]
+) {
+    wormotron_graphics_write_range(
+        graphics,
+        (u16)(WT_GRAPHICS_TILE_START + tile * WT_GRAPHICS_TILE_SIZE),
+        tile_data,
+        WT_GRAPHICS_TILE_SIZE
+    );
+}
+
+void wormotron_graphics_put_tile(wormotron_graphics_t* graphics, u8 x, u8 y, u8 tile) {
+    assert(x < WT_GRAPHICS_TILEMAP_WIDTH);
+    assert(y < WT_GRAPHICS_TILEMAP_HEIGHT);
+
+    wormotron_graphics_write(
+        graphics,
+        (u16)(WT_GRAPHICS_TILEMAP_START + y * WT_GRAPHICS_TILEMAP_WIDTH + x),
+        tile
+    );
+}
+
+void wormotron_graphics_set_sprite(
+    wormotron_graphics_t* graphics,
+    u8 sprite,
+    u8 x,
+    u8 y,
+    u8 tile,
+    u8 flags
+) {
+    assert(sprite < WT_GRAPHICS_SPRITE_COUNT);
+
+    u8 attributes[WT_GRAPHICS_SPRITE_SIZE] = { x, y, tile, flags };
+
+    wormotron_graphics_write_range(
+        graphics,
+        (u16)(WT_GRAPHICS_SPRITE_START + sprite * WT_GRAPHICS_SPRITE_SIZE),
+        attributes,
+        WT_GRAPHICS_SPRITE_SIZE
+    );
+}
+
+void wormotron_graphics_put_char(wormotron_graphics_t* graphics, u8 x, u8 y, u8 c, u8 colors) {
+    assert(x < WT_GRAPHICS_TEXT_COLUMNS);
+    assert(y < WT_GRAPHICS_TEXT_ROWS);
+
+    u16 cell = (u16)(y * WT_GRAPHICS_TEXT_COLUMNS + x);
+
+    wormotron_graphics_write(graphics, WT_GRAPHICS_TEXT_START + cell, c);
+    wormotron_graphics_write(graphics, WT_GRAPHICS_TEXT_COLORS_START + cell, colors);
+}
+
+void wormotron_graphics_set_scroll(wormotron_graphics_t* graphics, u8 x, u8 y) {
+    wormotron_graphics_write_reg(graphics, WT_GRAPHICS_REG_SCROLL_X, x);
+    wormotron_graphics_write_reg(graphics, WT_GRAPHICS_REG_SCROLL_Y, y);
+}
+
+static void wormotron_graphics_dirty_merge(
+    wormotron_graphics_dirty_t* dirty,
+    const wormotron_graphics_dirty_t* other
+) {
+    for (usize i = 0; i < sizeof(dirty->rows) / sizeof(dirty->rows[0]); i++) {
+        dirty->rows[i] |= other->rows[i];
+    }
+
+    for (usize i = 0; i < sizeof(dirty->tiles) / sizeof(dirty->tiles[0]); i++) {
+        dirty->tiles[i] |= other->tiles[i];
+    }
+
+    dirty->tilemap |= other->tilemap;
+    dirty->sprites |= other->sprites;
+    dirty->regs |= other->regs;
+    dirty->palette |= other->palette;
+}
+
+// called by the CPU thread once a frame is complete. copies the graphics RAM into the back
+// frame and swaps it with the ready one.
+void wormotron_graphics_publish(wormotron_graphics_t* graphics) {
+    memcpy(graphics->frames[graphics->back], graphics->ram, sizeof(graphics->ram));
+    memcpy(graphics->frame_regs[graphics->back], graphics->regs, sizeof(graphics->regs));
+
+    // the frame has to cover the changes of every frame the render thread may not have drawn.
+    // once it took the last one, it has all of them.
+    if (!wormotron_graphics_pending(graphics)) {
+        graphics->undrawn = (wormotron_graphics_dirty_t){ 0 };
+    }
+
+    wormotron_graphics_dirty_t changes = graphics->dirty;
+    wormotron_graphics_dirty_t published = changes;
+    wormotron_graphics_dirty_merge(&published, &graphics->undrawn);
+
+    graphics->frame_dirty[graphics->back] = published;
+    graphics->dirty = (wormotron_graphics_dirty_t){ 0 };
+
+    // the swap is a full barrier, so the copy is visible before the frame is
+    int ready = SDL_AtomicSet(&graphics->ready, graphics->back | WT_GRAPHICS_FRAME_FRESH);
+    graphics->back = (u8)(ready & WT_GRAPHICS_FRAME_INDEX);
+
+    // if the frame we got back was never taken, the render thread hasn't drawn anything since
+    // the frames before it either
+    graphics->undrawn = (ready & WT_GRAPHICS_FRAME_FRESH) ? published : changes;
+}
+
+// called by the render thread. takes the newest published frame, if there is one it hasn't
+// seen yet, and returns whether it did.
+bool wormotron_graphics_acquire(wormotron_graphics_t* graphics) {
+    if (!wormotron_graphics_pending(graphics)) {
+        return false;
+    }
+
+    int ready = SDL_AtomicSet(&graphics->ready, graphics->front);
+    graphics->front = (u8)(ready & WT_GRAPHICS_FRAME_INDEX);
+
+    return true;
+}
+
+// whether a published frame hasn't been taken by the render thread yet
+bool wormotron_graphics_pending(wormotron_graphics_t* graphics) {
+    return (SDL_AtomicGet(&graphics->ready) & WT_GRAPHICS_FRAME_FRESH) != 0;
+}
+
 void wormotron_graphics_clear(wormotron_graphics_t* graphics) {
+    if (graphics->headless) {
+        return;
+    }
+
     SDL_SetRenderDrawColor(graphics->renderer, 0, 0, 0, 255);
     SDL_RenderClear(graphics->renderer);
 }
 
-void wormotron_graphics_flush(wormotron_graphics_t* graphics) {
+// converts the front frame into the texture
+// reloads the palette from the palette area of `ram`
+// returns whether the palette differs from the one loaded before
+static bool wormotron_graphics_load_palette(wormotron_graphics_t* graphics, const u8* ram) {
+    SDL_Color previous[WT_GRAPHICS_PALETTE_SIZE];
+    memcpy(previous, graphics->palette, sizeof(previous));
+
     for (u16 i = 0; i < 16; i++) {
         SDL_Color color;
-        color.r = graphics->ram[WT_GRAPHICS_PALETTE_START + i * 4 + 0];
-        color.g = graphics->ram[WT_GRAPHICS_PALETTE_START + i * 4 + 1];
-        color.b = graphics->ram[WT_GRAPHICS_PALETTE_START + i * 4 + 2];
-        color.a = graphics->ram[WT_GRAPHICS_PALETTE_START + i * 4 + 3];
+        color.r = ram[WT_GRAPHICS_PALETTE_START + i * 4 + 0];
+        color.g = ram[WT_GRAPHICS_PALETTE_START + i * 4 + 1];
+        color.b = ram[WT_GRAPHICS_PALETTE_START + i * 4 + 2];
+        color.a = ram[WT_GRAPHICS_PALETTE_START + i * 4 + 3];
 
         graphics->palette[i] = color;
     }
 
-    SDL_Color* pixels = NULL;
+    bool changed = memcmp(previous, graphics->palette, sizeof(previous)) != 0;
+
+    if (graphics->palette_loaded && !changed) {
+        return false;
+    }
+
+    graphics->palette_loaded = true;
+    wormotron_expand_lut_set(&graphics->lut, graphics->palette);
+
+    return true;
+}
+
+// gives access to a `w` by `h` rect at `x`, `y` of the texture, or of the framebuffer when
+// headless. the pixels are write-only. returns NULL if the texture can't be locked.
+static u8* wormotron_graphics_lock_rect(
+    wormotron_graphics_t* graphics,
+    u16 x,
+    u16 y,
+    u16 w,
+    u16 h,
+    int* pitch
+) {
+    if (graphics->headless) {
+        *pitch = WT_WINDOW_LOGICAL_WIDTH * (int)sizeof(SDL_Color);
+        return (u8*)&graphics->pixels[y * WT_WINDOW_LOGICAL_WIDTH + x];
+    }
+
+    SDL_Rect rect = { x, y, w, h };
+    u8* pixels = NULL;
+
+    if (SDL_LockTexture(graphics->texture, &rect, (void**)&pixels, pitch) != 0) {
+        LOG_ERROR("Failed to lock texture: %s\n", SDL_GetError());
+        return NULL;
+    }
+
+    return pixels;
+}
+
+static void wormotron_graphics_unlock(wormotron_graphics_t* graphics) {
+    if (!graphics->headless) {
+        SDL_UnlockTexture(graphics->texture);
+    }
+}
+
+static inline bool wormotron_graphics_row_dirty(
+    const wormotron_graphics_dirty_t* dirty,
+    u32 row
+) {
+    return (dirty->rows[row / 64] & (1ull << (row % 64))) != 0;
+}
+
+// re-expands the framebuffer rows that changed, locking each run of them at once
+static void wormotron_graphics_flush_raw(
+    wormotron_graphics_t* graphics,
+    const u8* ram,
+    const wormotron_graphics_dirty_t* dirty,
+    bool repaint
+) {
+    u16 y = 0;
+
+    while (y < WT_WINDOW_LOGICAL_HEIGHT) {
+        if (!repaint && !wormotron_graphics_row_dirty(dirty, y)) {
+            y++;
+            continue;
+        }
+
+        u16 run_end = (u16)(y + 1);
+
+        while (run_end < WT_WINDOW_LOGICAL_HEIGHT &&
+               (repaint || wormotron_graphics_row_dirty(dirty, run_end))) {
+            run_end++;
+        }
+
+        int pitch = 0;
+        u8* pixels = wormotron_graphics_lock_rect(
+            graphics,
+            0,
+            y,
+            WT_WINDOW_LOGICAL_WIDTH,
+            (u16)(run_end - y),
+            &pitch
+        );
+
+        if (pixels == NULL) {
+            return;
+        }
+
+        for (u16 row = y; row < run_end; row++) {
+            graphics->expand(
+                (SDL_Color*)(pixels + (usize)(row - y) * (usize)pitch),
+                ram + row * WT_GRAPHICS_ROW_SIZE,
+                WT_GRAPHICS_ROW_SIZE,
+                &graphics->lut
+            );
+        }
+
+        wormotron_graphics_unlock(graphics);
+
+        y = run_end;
+    }
+}
+
+// returns the glyphs rasterized in the colors of `colors`, rasterizing them first if they're
+// stale
+static const SDL_Color* wormotron_graphics_glyphs(wormotron_graphics_t* graphics, u8 colors) {
+    u64 bit = 1ull << (colors % 64);
+
+    if (graphics->glyph_cache[colors] == NULL) {
+        graphics->glyph_cache[colors] =
+            malloc(WT_GRAPHICS_GLYPH_COUNT * WT_GRAPHICS_GLYPH_PIXELS * sizeof(SDL_Color));
+
+        if (graphics->glyph_cache[colors] == NULL) {
+            LOG_ERROR("Failed to allocate memory for glyphs\n");
+            exit(1);
+        }
+
+        graphics->glyph_stale[colors / 64] |= bit;
+    }
+
+    SDL_Color* glyphs = graphics->glyph_cache[colors];
+
+    if (graphics->glyph_stale[colors / 64] & bit) {
+        u8 used = colors != 0 ? colors : WT_GRAPHICS_TEXT_DEFAULT_COLORS;
+        SDL_Color fg = graphics->palette[used & 0x0f];
+        SDL_Color bg = graphics->palette[used >> 4];
+
+        for (u8 c = 0; c < WT_GRAPHICS_GLYPH_COUNT; c++) {
+            const u8* columns = wormotron_font_glyph(c);
+            SDL_Color* glyph = glyphs + c * WT_GRAPHICS_GLYPH_PIXELS;
+
+            for (u8 y = 0; y < WT_GRAPHICS_TEXT_CELL_HEIGHT; y++) {
+                for (u8 x = 0; x < WT_GRAPHICS_TEXT_CELL_WIDTH; x++) {
+                    bool set = x < WT_FONT_WIDTH && (columns[x] >> y) & 1;
+                    glyph[y * WT_GRAPHICS_TEXT_CELL_WIDTH + x] = set ? fg : bg;
+                }
+            }
+        }
+
+        graphics->glyph_stale[colors / 64] &= ~bit;
+    }
+
+    return glyphs;
+}
+
+// whether the character or the color byte of `cell` changed
+static inline bool wormotron_graphics_cell_dirty(
+    const wormotron_graphics_dirty_t* dirty,
+    u16 cell
+) {
+    u32 chars = (u32)(WT_GRAPHICS_TEXT_START + cell);
+    u32 colors = (u32)(WT_GRAPHICS_TEXT_COLORS_START + cell);
+
+    return wormotron_graphics_row_dirty(dirty, chars / WT_GRAPHICS_ROW_SIZE) ||
+           wormotron_graphics_row_dirty(dirty, colors / WT_GRAPHICS_ROW_SIZE);
+}
+
+// redraws the cells that changed from cached glyphs, locking each run of them at once.
+// cells share the dirty framebuffer rows of the bytes they're stored in.
+static void wormotron_graphics_flush_text(
+    wormotron_graphics_t* graphics,
+    const u8* ram,
+    const wormotron_graphics_dirty_t* dirty,
+    bool repaint
+) {
+    for (u16 row = 0; row < WT_GRAPHICS_TEXT_ROWS; row++) {
+        u16 first = row * WT_GRAPHICS_TEXT_COLUMNS;
+        u16 column = 0;
+
+        while (column < WT_GRAPHICS_TEXT_COLUMNS) {
+            if (!repaint && !wormotron_graphics_cell_dirty(dirty, first + column)) {
+                column++;
+                continue;
+            }
+
+            u16 run_end = (u16)(column + 1);
+
+            while (run_end < WT_GRAPHICS_TEXT_COLUMNS &&
+                   (repaint || wormotron_graphics_cell_dirty(dirty, first + run_end))) {
+                run_end++;
+            }
+
+            int pitch = 0;
+            u8* pixels = wormotron_graphics_lock_rect(
+                graphics,
+                column * WT_GRAPHICS_TEXT_CELL_WIDTH,
+                row * WT_GRAPHICS_TEXT_CELL_HEIGHT,
+                (u16)((run_end - column) * WT_GRAPHICS_TEXT_CELL_WIDTH),
+                WT_GRAPHICS_TEXT_CELL_HEIGHT,
+                &pitch
+            );
+
+            if (pixels == NULL) {
+                return;
+            }
+
+            for (u16 i = column; i < run_end; i++) {
+                u8 c = ram[WT_GRAPHICS_TEXT_START + first + i];
+                u8 colors = ram[WT_GRAPHICS_TEXT_COLORS_START + first + i];
+                const SDL_Color* glyph = wormotron_graphics_glyphs(graphics, colors) +
+                                         (c < WT_GRAPHICS_GLYPH_COUNT ? c : ' ') *
+                                             WT_GRAPHICS_GLYPH_PIXELS;
+
+                usize offset =
+                    (usize)(i - column) * WT_GRAPHICS_TEXT_CELL_WIDTH * sizeof(SDL_Color);
+
+                for (u16 y = 0; y < WT_GRAPHICS_TEXT_CELL_HEIGHT; y++) {
+                    memcpy(
+                        pixels + (usize)y * (usize)pitch + offset,
+                        glyph + y * WT_GRAPHICS_TEXT_CELL_WIDTH,
+                        WT_GRAPHICS_TEXT_CELL_WIDTH * sizeof(SDL_Color)
+                    );
+                }
+            }
+
+            wormotron_graphics_unlock(graphics);
+
+            column = run_end;
+        }
+    }
+}
+
+// returns the expanded pixels of `tile`, expanding it first if it's stale
+static const SDL_Color* wormotron_graphics_tile(
+    wormotron_graphics_t* graphics,
+    const u8* ram,
+    u8 tile
+) {
+    u64 bit = 1ull << (tile % 64);
+
+    if (graphics->tile_stale[tile / 64] & bit) {
+        graphics->expand(
+            graphics->tile_cache[tile],
+            ram + WT_GRAPHICS_TILE_START + tile * WT_GRAPHICS_TILE_SIZE,
+            WT_GRAPHICS_TILE_SIZE,
+            &graphics->lut
+        );
+        graphics->tile_stale[tile / 64] &= ~bit;
+    }
+
+    return graphics->tile_cache[tile];
+}
+
+// draws one row of the scrolled tilemap from cached tiles
+static void wormotron_graphics_compose_tiles(
+    wormotron_graphics_t* graphics,
+    SDL_Color* dst,
+    const u8* ram,
+    const u8* regs,
+    u16 y
+) {
+    // the tilemap is 256 pixels each way, so u8 coordinates wrap around by themselves
+    u8 map_y = (u8)(regs[WT_GRAPHICS_REG_SCROLL_Y] + y);
+    u8 map_x = regs[WT_GRAPHICS_REG_SCROLL_X];
+    const u8* map_row = ram + WT_GRAPHICS_TILEMAP_START +
+                        (map_y / WT_GRAPHICS_TILE_WIDTH) * WT_GRAPHICS_TILEMAP_WIDTH;
+    u16 tile_row = (map_y % WT_GRAPHICS_TILE_WIDTH) * WT_GRAPHICS_TILE_WIDTH;
+
+    for (u16 x = 0; x < WT_WINDOW_LOGICAL_WIDTH;) {
+        const SDL_Color* tile =
+            wormotron_graphics_tile(graphics, ram, map_row[map_x / WT_GRAPHICS_TILE_WIDTH]);
+        u16 tile_x = map_x % WT_GRAPHICS_TILE_WIDTH;
+        u16 count = WT_GRAPHICS_TILE_WIDTH - tile_x;
+
+        if (count > WT_WINDOW_LOGICAL_WIDTH - x) {
+            count = WT_WINDOW_LOGICAL_WIDTH - x;
+        }
+
+        memcpy(dst + x, tile + tile_row + tile_x, count * sizeof(SDL_Color));
+
+        x = (u16)(x + count);
+        map_x = (u8)(map_x + count);
+    }
+}
+
+// draws the sprites covering row `y` over it, the first sprite ending up on top
+static void wormotron_graphics_compose_sprites(
+    wormotron_graphics_t* graphics,
+    SDL_Color* dst,
+    const u8* ram,
+    u16 y
+) {
+    for (int i = WT_GRAPHICS_SPRITE_COUNT - 1; i >= 0; i--) {
+        const u8* sprite = ram + WT_GRAPHICS_SPRITE_START + i * WT_GRAPHICS_SPRITE_SIZE;
+        u8 flags = sprite[3];
+
+        // sprite coordinates are offset, so compare in that space to avoid going negative
+        int sprite_y = y + WT_GRAPHICS_SPRITE_OFFSET - sprite[1];
+
+        if (!(flags & WT_GRAPHICS_SPRITE_VISIBLE) || sprite_y < 0 ||
+            sprite_y >= WT_GRAPHICS_TILE_WIDTH) {
+            continue;
+        }
+
+        if (flags & WT_GRAPHICS_SPRITE_FLIP_Y) {
+            sprite_y = WT_GRAPHICS_TILE_WIDTH - 1 - sprite_y;
+        }
+
+        const u8* row = ram + WT_GRAPHICS_TILE_START + sprite[2] * WT_GRAPHICS_TILE_SIZE +
+                        sprite_y * (WT_GRAPHICS_TILE_WIDTH / 2);
+        u8 palette_shift = flags >> WT_GRAPHICS_SPRITE_PALETTE_SHIFT;
+
+        for (int sprite_x = 0; sprite_x < WT_GRAPHICS_TILE_WIDTH; sprite_x++) {
+            int x = sprite[0] - WT_GRAPHICS_SPRITE_OFFSET + sprite_x;
+
+            if (x < 0 || x >= WT_WINDOW_LOGICAL_WIDTH) {
+                continue;
+            }
+
+            int pixel = sprite_x;
+
+            if (flags & WT_GRAPHICS_SPRITE_FLIP_X) {
+                pixel = WT_GRAPHICS_TILE_WIDTH - 1 - sprite_x;
+            }
+
+            u8 color = pixel % 2 ? row[pixel / 2] & 0x0f : row[pixel / 2] >> 4;
+
+            if (color != 0) {
+                dst[x] = graphics->palette[(color + palette_shift) % WT_GRAPHICS_PALETTE_SIZE];
+            }
+        }
+    }
+}
+
+// composes the whole screen, from the tilemap in tiled mode or from palette color 0 in
+// sprite-only mode, with the sprites on top
+static void wormotron_graphics_compose(
+    wormotron_graphics_t* graphics,
+    const u8* ram,
+    const u8* regs,
+    wormotron_graphics_mode_t mode
+) {
     int pitch = 0;
+    u8* pixels = wormotron_graphics_lock_rect(
+        graphics,
+        0,
+        0,
+        WT_WINDOW_LOGICAL_WIDTH,
+        WT_WINDOW_LOGICAL_HEIGHT,
+        &pitch
+    );
 
-    SDL_LockTexture(graphics->texture, NULL, (void**)&pixels, &pitch);
+    if (pixels == NULL) {
+        return;
+    }
 
     for (u16 y = 0; y < WT_WINDOW_LOGICAL_HEIGHT; y++) {
-        for (u16 x = 0; x < WT_WINDOW_LOGICAL_WIDTH / 2; x++) {
-            u8 colors = graphics->ram[y * WT_WINDOW_LOGICAL_WIDTH / 2 + x];
-            u8 first = colors >> 4;
-            u8 second = colors & 0x0F;
-
-            pixels[y * WT_WINDOW_LOGICAL_WIDTH + x * 2] = graphics->palette[first];
-            pixels[y * WT_WINDOW_LOGICAL_WIDTH + x * 2 + 1] = graphics->palette[second];
+        SDL_Color* dst = (SDL_Color*)(pixels + (usize)y * (usize)pitch);
+
+        if (mode == WT_GRAPHICS_MODE_TILED) {
+            wormotron_graphics_compose_tiles(graphics, dst, ram, regs, y);
+        } else {
+            for (u16 x = 0; x < WT_WINDOW_LOGICAL_WIDTH; x++) {
+                dst[x] = graphics->palette[0];
+            }
         }
+
+        wormotron_graphics_compose_sprites(graphics, dst, ram, y);
     }
 
-    SDL_UnlockTexture(graphics->texture);
+    wormotron_graphics_unlock(graphics);
+}
+
+// draws the front frame. only what changed since the last flush is drawn again, and the
+// texture isn't touched at all if nothing did.
+void wormotron_graphics_flush(wormotron_graphics_t* graphics) {
+    const u8* ram = graphics->frames[graphics->front];
+    const u8* regs = graphics->frame_regs[graphics->front];
+    wormotron_graphics_dirty_t* dirty = &graphics->frame_dirty[graphics->front];
+
+    wormotron_graphics_mode_t mode = regs[WT_GRAPHICS_REG_MODE];
+    // sprites share a page of graphics RAM with the palette, so it's marked dirty more often
+    // than it changes
+    bool palette_changed = dirty->palette && wormotron_graphics_load_palette(graphics, ram);
+    bool repaint = palette_changed || mode != graphics->mode;
+
+    graphics->mode = mode;
+
+    if (palette_changed) {
+        memset(graphics->tile_stale, 0xff, sizeof(graphics->tile_stale));
+        memset(graphics->glyph_stale, 0xff, sizeof(graphics->glyph_stale));
+    }
+
+    bool tiles_changed = false;
+
+    for (usize i = 0; i < sizeof(dirty->tiles) / sizeof(dirty->tiles[0]); i++) {
+        graphics->tile_stale[i] |= dirty->tiles[i];
+        tiles_changed |= dirty->tiles[i] != 0;
+    }
+
+    switch (mode) {
+        case WT_GRAPHICS_MODE_TEXT:
+            wormotron_graphics_flush_text(graphics, ram, dirty, repaint);
+            break;
+        case WT_GRAPHICS_MODE_TILED:
+            if (repaint || tiles_changed || dirty->tilemap || dirty->sprites || dirty->regs) {
+                wormotron_graphics_compose(graphics, ram, regs, mode);
+            }
+            break;
+        case WT_GRAPHICS_MODE_SPRITEONLY:
+            if (repaint || tiles_changed || dirty->sprites) {
+                wormotron_graphics_compose(graphics, ram, regs, mode);
+            }
+            break;
+        default:
+            wormotron_graphics_flush_raw(graphics, ram, dirty, repaint);
+            break;
+    }
+
+    *dirty = (wormotron_graphics_dirty_t){ 0 };
 }
 
 void wormotron_graphics_present(wormotron_graphics_t* graphics) {
+    if (graphics->headless) {
+        return;
+    }
+
     SDL_RenderCopy(graphics->renderer, graphics->texture, NULL, NULL);
 
     SDL_RenderPresent(graphics->renderer);
 }
 
+// writes the headless framebuffer to `path`
+void wormotron_graphics_dump(
+    wormotron_graphics_t* graphics,
+    const char* path,
+    wormotron_graphics_dump_format_t format
+) {
+    assert(graphics->headless);
+
+    FILE* file = fopen(path, "wb");
+
+    if (file == NULL) {
+        LOG_ERROR("Failed to open frame dump file: %s\n", path);
+        exit(1);
+    }
+
+    if (format == WT_GRAPHICS_DUMP_RAW) {
+        fwrite(graphics->pixels, 1, sizeof(graphics->pixels), file);
+    } else {
+        u8 rgb[WT_WINDOW_LOGICAL_WIDTH * WT_WINDOW_LOGICAL_HEIGHT * 3];
+
+        for (usize i = 0; i < WT_WINDOW_LOGICAL_WIDTH * WT_WINDOW_LOGICAL_HEIGHT; i++) {
+            rgb[i * 3 + 0] = graphics->pixels[i].r;
+            rgb[i * 3 + 1] = graphics->pixels[i].g;
+            rgb[i * 3 + 2] = graphics->pixels[i].b;
+        }
+
+        fprintf(file, "P6\n%d %d\n255\n", WT_WINDOW_LOGICAL_WIDTH, WT_WINDOW_LOGICAL_HEIGHT);
+        fwrite(rgb, 1, sizeof(rgb), file);
+    }
+
+    if (fclose(file) != 0) {
+        LOG_ERROR("Failed to write frame dump file: %s\n", path);
+        exit(1);
+    }
+}
+
 void wormotron_graphics_draw_pixel(wormotron_graphics_t* graphics, u8 x, u8 y, u8 color) {
     assert(x < WT_WINDOW_LOGICAL_WIDTH);
     assert(y < WT_WINDOW_LOGICAL_HEIGHT);
     assert(color < WT_GRAPHICS_PALETTE_SIZE);
 
+    if (graphics->headless) {
+        graphics->pixels[y * WT_WINDOW_LOGICAL_WIDTH + x] = graphics->palette[color];
+        return;
+    }
+
     SDL_Color* pixels = NULL;
     int pitch = 0;
 
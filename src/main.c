@@ -4,6 +4,7 @@
 #include "rom.h"
 
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,27 +17,121 @@
 
 typedef struct args {
     char* rom_file;
+    wormotron_config_t config;
 } args_t;
 
 static void usage(void) {
-    printf("Usage: wormotron <rom_file>\n");
+    printf(
+        "Usage: wormotron <rom_file> [-f, --ops-per-frame <count>] [--headless]\n"
+        "                 [--frames <count>] [--dump-every <count>] [--dump-dir <dir>]\n"
+        "                 [--dump-format ppm|raw] [--load-state <file>]\n"
+        "                 [--save-state <file>] [--watch]\n"
+    );
+}
+
+// returns the value of the option at `argv[*i]` and skips over it
+static char* option_value(int argc, char* argv[], int* i) {
+    if (*i + 1 >= argc) {
+        usage();
+        exit(1);
+    }
+
+    return argv[++*i];
+}
+
+static u64 parse_count(const char* value, const char* what, u64 max) {
+    char* end = NULL;
+    unsigned long long count = strtoull(value, &end, 0);
+
+    if (*value == '\0' || *end != '\0' || count > max) {
+        LOG_ERROR("Invalid %s: %s\n", what, value);
+        exit(1);
+    }
+
+    return (u64)count;
 }
 
 static args_t parse_args(int argc, char* argv[]) {
-    args_t args;
-    if (argc < 2 || argc > 5) {
+    args_t args = { .config = wormotron_config_default() };
+    if (argc < 2) {
         usage();
         exit(1);
     }
 
-    args.rom_file = argv[1];
+    bool rom_file_exists = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--ops-per-frame") == 0) {
+            char* value = option_value(argc, argv, &i);
+            args.config.ops_per_frame =
+                (u32)parse_count(value, "instructions per frame", UINT32_MAX);
+
+            if (args.config.ops_per_frame == 0) {
+                LOG_ERROR("Invalid instructions per frame: %s\n", value);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            args.config.headless = true;
+        } else if (strcmp(argv[i], "--frames") == 0) {
+            char* value = option_value(argc, argv, &i);
+            args.config.frame_limit = parse_count(value, "frame count", UINT64_MAX);
+        } else if (strcmp(argv[i], "--dump-every") == 0) {
+            char* value = option_value(argc, argv, &i);
+            args.config.dump_every = (u32)parse_count(value, "dump interval", UINT32_MAX);
+        } else if (strcmp(argv[i], "--dump-dir") == 0) {
+            args.config.dump_dir = option_value(argc, argv, &i);
+        } else if (strcmp(argv[i], "--dump-format") == 0) {
+            char* value = option_value(argc, argv, &i);
+
+            if (strcmp(value, "ppm") == 0) {
+                args.config.dump_format = WT_GRAPHICS_DUMP_PPM;
+            } else if (strcmp(value, "raw") == 0) {
+                args.config.dump_format = WT_GRAPHICS_DUMP_RAW;
+            } else {
+                LOG_ERROR("Invalid dump format: %s\n", value);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--load-state") == 0) {
+            args.config.load_state = option_value(argc, argv, &i);
+        } else if (strcmp(argv[i], "--save-state") == 0) {
+            args.config.save_state = option_value(argc, argv, &i);
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            args.config.watch = true;
+        } else if (!rom_file_exists) {
+            args.rom_file = argv[i];
+            rom_file_exists = true;
+        } else {
+            usage();
+            exit(1);
+        }
+    }
+
+    if (!rom_file_exists) {
+        usage();
+        exit(1);
+    }
+
+    if (args.config.dump_every != 0 && !args.config.headless) {
+        LOG_ERROR("Frame dumps need --headless\n");
+        exit(1);
+    }
+
+    if (args.config.watch && !wormotron_rom_is_source(args.rom_file)) {
+        LOG_ERROR("--watch needs a " WT_ROM_SOURCE_EXTENSION " source\n");
+        exit(1);
+    }
+
+    if (args.config.watch && args.config.headless) {
+        LOG_ERROR("--watch can't be used with --headless\n");
+        exit(1);
+    }
 
     return args;
 }
 
 void terminate_handler(int signal) {
     (void)signal; // unused
-    g_stop = true;
+    g_signal_stop = 1;
 }
 
 // TODO: This is a hack to get around SDL's main macro.
@@ -49,8 +144,7 @@ int main(int argc, char* argv[]) {
 
     args_t args = parse_args(argc, argv);
 
-    wormotron_t* wormotron = wormotron_new(args.rom_file);
-    g_wormotron = wormotron;
+    wormotron_t* wormotron = wormotron_new(args.rom_file, &args.config);
 
     wormotron_run(wormotron);
 
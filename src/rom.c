@@ -3,11 +3,31 @@
 #include "log.h"
 #include "types.h"
 #include "utils.h"
+#include "weave.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+bool wormotron_rom_is_source(const char* rom_file) {
+    usize len = strlen(rom_file);
+    usize extension_len = strlen(WT_ROM_SOURCE_EXTENSION);
+
+    return len > extension_len &&
+           strcmp(rom_file + len - extension_len, WT_ROM_SOURCE_EXTENSION) == 0;
+}
 
 wormotron_rom_t* wormotron_rom_load(const char* rom_file) {
+    if (wormotron_rom_is_source(rom_file)) {
+        wormotron_rom_t* rom = wormotron_rom_assemble(rom_file);
+
+        if (rom == NULL) {
+            exit(1);
+        }
+
+        return rom;
+    }
+
     FILE* rom_stream = fopen(rom_file, "r");
 
     if (rom_stream == NULL) {
@@ -53,6 +73,99 @@ wormotron_rom_t* wormotron_rom_load(const char* rom_file) {
     return rom;
 }
 
+// reads the whole source, NULL if it can't be read
+static char* wormotron_rom_read_source(const char* source_file, usize* len) {
+    FILE* stream = fopen(source_file, "rb");
+
+    if (stream == NULL) {
+        LOG_ERROR("Failed to open source file: %s\n", source_file);
+        return NULL;
+    }
+
+    fseek(stream, 0, SEEK_END);
+    long size = ftell(stream);
+    fseek(stream, 0, SEEK_SET);
+
+    char* src = size < 0 ? NULL : malloc((usize)size + 1);
+
+    if (src == NULL) {
+        LOG_ERROR("Failed to read source file: %s\n", source_file);
+        fclose(stream);
+        return NULL;
+    }
+
+    *len = fread(src, 1, (usize)size, stream);
+
+    fclose(stream);
+
+    return src;
+}
+
+// assembles a `weave` source into a ROM. the diagnostics are logged, and NULL is returned if
+// there were any, so a broken source never replaces a running program.
+wormotron_rom_t* wormotron_rom_assemble(const char* source_file) {
+    usize len;
+    char* src = wormotron_rom_read_source(source_file, &len);
+
+    if (src == NULL) {
+        return NULL;
+    }
+
+    weave_result_t result;
+    bool ok = weave_assemble_buffer(src, len, &result);
+
+    free(src);
+
+    for (usize i = 0; i < result.diagnostic_count; i++) {
+        const weave_diagnostic_t* diagnostic = &result.diagnostics[i];
+
+        if (diagnostic->line == 0) {
+            LOG_ERROR("%s: %s\n", source_file, diagnostic->message);
+        } else {
+            LOG_ERROR(
+                "%s:%u:%u: %s\n",
+                source_file,
+                diagnostic->line,
+                diagnostic->col,
+                diagnostic->message
+            );
+        }
+    }
+
+    if (ok && result.image_len > 0x10000) {
+        LOG_ERROR("Rom too large: %s assembles to %zu\n", source_file, result.image_len);
+        ok = false;
+    }
+
+    if (!ok) {
+        weave_result_free(&result);
+        return NULL;
+    }
+
+    LOG_DEBUG(
+        "Assembled %s: %zu bytes, %zu labels\n",
+        source_file,
+        result.image_len,
+        result.symbol_count
+    );
+
+    wormotron_rom_t* rom = malloc(sizeof(wormotron_rom_t));
+
+    if (rom == NULL) {
+        LOG_ERROR("Failed to allocate memory for rom: %s\n", source_file);
+        exit(1);
+    }
+
+    // the image is handed over to the rom, the rest of the result isn't needed
+    rom->data = result.image;
+    rom->size = (u16)result.image_len;
+    result.image = NULL;
+
+    weave_result_free(&result);
+
+    return rom;
+}
+
 void wormotron_rom_free(wormotron_rom_t* rom) {
     free(rom->data);
     free(rom);
@@ -0,0 +1,286 @@
+#include "state.h"
+
+#include "blitter.h"
+#include "graphics.h"
+#include "log.h"
+#include "squirm.h"
+#include "types.h"
+#include "wormotron.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// FNV-1a, so a state is only ever restored onto the ROM it was saved from
+static u32 wormotron_state_rom_hash(const wormotron_rom_t* rom) {
+    u32 hash = 0x811c9dc5;
+
+    for (u32 i = 0; i < rom->size; i++) {
+        hash = (hash ^ rom->data[i]) * 0x01000193;
+    }
+
+    return hash;
+}
+
+wormotron_state_t* wormotron_state_capture(wormotron_t* wormotron) {
+    wormotron_state_t* state = malloc(sizeof(wormotron_state_t));
+
+    if (state == NULL) {
+        LOG_ERROR("Failed to allocate memory for state\n");
+        exit(1);
+    }
+
+    state->cpu =
+        squirm_cpu_snapshot(wormotron->cpu, wormotron->rom->data, wormotron->rom->size);
+
+    wormotron_graphics_read_range(
+        wormotron->graphics,
+        0,
+        state->graphics_ram,
+        WT_GRAPHICS_RAM_SIZE
+    );
+
+    for (u8 reg = 0; reg < WT_GRAPHICS_REG_COUNT; reg++) {
+        state->graphics_regs[reg] = wormotron_graphics_read_reg(wormotron->graphics, reg);
+    }
+
+    memcpy(state->blitter_regs, wormotron->blitter->regs, sizeof(state->blitter_regs));
+
+    return state;
+}
+
+// the restored frame is drawn in full, since all of graphics RAM is marked as written
+void wormotron_state_restore(wormotron_t* wormotron, const wormotron_state_t* state) {
+    squirm_cpu_restore(
+        wormotron->cpu,
+        state->cpu,
+        wormotron->rom->data,
+        wormotron->rom->size
+    );
+
+    wormotron_graphics_write_range(
+        wormotron->graphics,
+        0,
+        state->graphics_ram,
+        WT_GRAPHICS_RAM_SIZE
+    );
+
+    for (u8 reg = 0; reg < WT_GRAPHICS_REG_COUNT; reg++) {
+        wormotron_graphics_write_reg(wormotron->graphics, reg, state->graphics_regs[reg]);
+    }
+
+    // written directly, so a saved go bit doesn't start a blit
+    memcpy(wormotron->blitter->regs, state->blitter_regs, sizeof(state->blitter_regs));
+}
+
+void wormotron_state_free(wormotron_state_t* state) {
+    squirm_snapshot_free(state->cpu);
+    free(state);
+}
+
+// all values in a save state are little-endian
+
+static void wormotron_state_write(FILE* stream, const void* data, usize len, const char* path) {
+    if (fwrite(data, 1, len, stream) != len) {
+        LOG_ERROR("Failed to write state file: %s\n", path);
+        exit(1);
+    }
+}
+
+static void wormotron_state_write_u64(FILE* stream, u64 value, usize len, const char* path) {
+    u8 bytes[8];
+
+    for (usize i = 0; i < len; i++) {
+        bytes[i] = (u8)(value >> (i * 8));
+    }
+
+    wormotron_state_write(stream, bytes, len, path);
+}
+
+static void wormotron_state_read(FILE* stream, void* data, usize len, const char* path) {
+    if (fread(data, 1, len, stream) != len) {
+        LOG_ERROR("Truncated state file: %s\n", path);
+        exit(1);
+    }
+}
+
+static u64 wormotron_state_read_u64(FILE* stream, usize len, const char* path) {
+    u8 bytes[8];
+    u64 value = 0;
+
+    wormotron_state_read(stream, bytes, len, path);
+
+    for (usize i = 0; i < len; i++) {
+        value |= (u64)bytes[i] << (i * 8);
+    }
+
+    return value;
+}
+
+// layout, version 1:
+// - magic, version (u16), ROM size (u32) and ROM hash (u32)
+// - CPU registers (u16 each), executed instruction count (u64), bitmap of the memory pages
+//   that differ from the ROM (u64 each), then those pages
+// - bitmap of the graphics RAM pages that aren't all zeros (u64), then those pages
+// - graphics registers, blitter registers
+void wormotron_state_save(
+    const wormotron_t* wormotron,
+    const wormotron_state_t* state,
+    const char* path
+) {
+    FILE* stream = fopen(path, "wb");
+
+    if (stream == NULL) {
+        LOG_ERROR("Failed to open state file: %s\n", path);
+        exit(1);
+    }
+
+    wormotron_state_write(stream, WT_STATE_MAGIC, 4, path);
+    wormotron_state_write_u64(stream, WT_STATE_VERSION, 2, path);
+    wormotron_state_write_u64(stream, wormotron->rom->size, 4, path);
+    wormotron_state_write_u64(stream, wormotron_state_rom_hash(wormotron->rom), 4, path);
+
+    const squirm_snapshot_t* cpu = state->cpu;
+
+    for (usize i = 0; i < BURROW_REG_COUNT; i++) {
+        wormotron_state_write_u64(stream, cpu->reg[i], 2, path);
+    }
+
+    wormotron_state_write_u64(stream, cpu->executed_op_count, 8, path);
+
+    for (usize i = 0; i < SQUIRM_SNAPSHOT_PAGE_COUNT / 64; i++) {
+        wormotron_state_write_u64(stream, cpu->pages[i], 8, path);
+    }
+
+    wormotron_state_write(
+        stream,
+        cpu->data,
+        (usize)cpu->page_count * SQUIRM_SNAPSHOT_PAGE_SIZE,
+        path
+    );
+
+    static const u8 k_zero_page[WT_STATE_GRAPHICS_PAGE_SIZE] = { 0 };
+    u64 graphics_pages = 0;
+
+    for (u8 page = 0; page < WT_STATE_GRAPHICS_PAGE_COUNT; page++) {
+        const u8* data = state->graphics_ram + page * WT_STATE_GRAPHICS_PAGE_SIZE;
+
+        if (memcmp(data, k_zero_page, WT_STATE_GRAPHICS_PAGE_SIZE) != 0) {
+            graphics_pages |= 1ull << page;
+        }
+    }
+
+    wormotron_state_write_u64(stream, graphics_pages, 8, path);
+
+    for (u8 page = 0; page < WT_STATE_GRAPHICS_PAGE_COUNT; page++) {
+        if (graphics_pages & (1ull << page)) {
+            wormotron_state_write(
+                stream,
+                state->graphics_ram + page * WT_STATE_GRAPHICS_PAGE_SIZE,
+                WT_STATE_GRAPHICS_PAGE_SIZE,
+                path
+            );
+        }
+    }
+
+    wormotron_state_write(stream, state->graphics_regs, WT_GRAPHICS_REG_COUNT, path);
+    wormotron_state_write(stream, state->blitter_regs, WT_BLITTER_REG_COUNT, path);
+
+    if (fclose(stream) != 0) {
+        LOG_ERROR("Failed to write state file: %s\n", path);
+        exit(1);
+    }
+
+    LOG_DEBUG("Saved state to %s\n", path);
+}
+
+wormotron_state_t* wormotron_state_load(const wormotron_t* wormotron, const char* path) {
+    FILE* stream = fopen(path, "rb");
+
+    if (stream == NULL) {
+        LOG_ERROR("Failed to open state file: %s\n", path);
+        exit(1);
+    }
+
+    char magic[4];
+    wormotron_state_read(stream, magic, sizeof(magic), path);
+
+    if (memcmp(magic, WT_STATE_MAGIC, sizeof(magic)) != 0) {
+        LOG_ERROR("Not a state file: %s\n", path);
+        exit(1);
+    }
+
+    u64 version = wormotron_state_read_u64(stream, 2, path);
+
+    if (version != WT_STATE_VERSION) {
+        LOG_ERROR("Unsupported state file version %" PRIu64 ": %s\n", version, path);
+        exit(1);
+    }
+
+    u64 rom_size = wormotron_state_read_u64(stream, 4, path);
+    u64 rom_hash = wormotron_state_read_u64(stream, 4, path);
+
+    if (rom_size != wormotron->rom->size ||
+        rom_hash != wormotron_state_rom_hash(wormotron->rom)) {
+        LOG_ERROR("State file was saved from a different ROM: %s\n", path);
+        exit(1);
+    }
+
+    u16 reg[BURROW_REG_COUNT];
+
+    for (usize i = 0; i < BURROW_REG_COUNT; i++) {
+        reg[i] = (u16)wormotron_state_read_u64(stream, 2, path);
+    }
+
+    u64 executed_op_count = wormotron_state_read_u64(stream, 8, path);
+    u64 pages[SQUIRM_SNAPSHOT_PAGE_COUNT / 64];
+    u16 page_count = 0;
+
+    for (usize i = 0; i < SQUIRM_SNAPSHOT_PAGE_COUNT / 64; i++) {
+        pages[i] = wormotron_state_read_u64(stream, 8, path);
+    }
+
+    for (u16 page = 0; page < SQUIRM_SNAPSHOT_PAGE_COUNT; page++) {
+        if (pages[page / 64] & (1ull << (page % 64))) {
+            page_count++;
+        }
+    }
+
+    usize data_size = (usize)page_count * SQUIRM_SNAPSHOT_PAGE_SIZE;
+    wormotron_state_t* state = malloc(sizeof(wormotron_state_t));
+    squirm_snapshot_t* cpu = malloc(sizeof(squirm_snapshot_t) + data_size);
+
+    if (state == NULL || cpu == NULL) {
+        LOG_ERROR("Failed to allocate memory for state\n");
+        exit(1);
+    }
+
+    memcpy(cpu->reg, reg, sizeof(cpu->reg));
+    cpu->executed_op_count = executed_op_count;
+    memcpy(cpu->pages, pages, sizeof(cpu->pages));
+    cpu->page_count = page_count;
+    wormotron_state_read(stream, cpu->data, data_size, path);
+    state->cpu = cpu;
+
+    u64 graphics_pages = wormotron_state_read_u64(stream, 8, path);
+
+    for (u8 page = 0; page < WT_STATE_GRAPHICS_PAGE_COUNT; page++) {
+        u8* data = state->graphics_ram + page * WT_STATE_GRAPHICS_PAGE_SIZE;
+
+        if (graphics_pages & (1ull << page)) {
+            wormotron_state_read(stream, data, WT_STATE_GRAPHICS_PAGE_SIZE, path);
+        } else {
+            memset(data, 0, WT_STATE_GRAPHICS_PAGE_SIZE);
+        }
+    }
+
+    wormotron_state_read(stream, state->graphics_regs, WT_GRAPHICS_REG_COUNT, path);
+    wormotron_state_read(stream, state->blitter_regs, WT_BLITTER_REG_COUNT, path);
+
+    fclose(stream);
+
+    LOG_DEBUG("Loaded state from %s\n", path);
+
+    return state;
+}
@@ -1,18 +1,31 @@
-#include "SDL_mutex.h"
+#include "SDL_thread.h"
+#include "SDL_timer.h"
+#include "blitter.h"
 #include "graphics.h"
 #include "log.h"
 #include "squirm.h"
 #include "types.h"
 #include "rom.h"
+#include "state.h"
 #include "wormotron.h"
 
+#include <inttypes.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 
-bool g_stop = false;
-bool g_wait_for_present = false;
-wormotron_t* g_wormotron = NULL;
+SDL_atomic_t g_stop = { 0 };
+volatile sig_atomic_t g_signal_stop = 0;
+
+// polls the signal flag on the main thread, returns true once either thread asked to stop
+static bool wormotron_should_stop(void) {
+    if (g_signal_stop) {
+        SDL_AtomicSet(&g_stop, 1);
+    }
+
+    return SDL_AtomicGet(&g_stop) != 0;
+}
 
 static void syscall_exit(squirm_cpu_t* cpu) {
     cpu->reg[BURROW_REG_FL] |= BURROW_FL_FIN;
@@ -32,27 +45,54 @@ static void syscall_print(squirm_cpu_t* cpu) {
 }
 
 static void syscall_wait_for_present(squirm_cpu_t* cpu) {
-    (void)cpu; // unused
-    g_wait_for_present = true;
+    wormotron_t* wormotron = cpu->user;
+    wormotron->wait_for_present = true;
 }
 
-static void mmio_instant_putc_write(u16 addr, u8 val) {
+static void mmio_instant_putc_write(void* user, u16 addr, u8 val) {
+    (void)user; // unused
     (void)addr; // unused
 
     putc(val, stdout);
     fflush(stdout);
 }
 
-static void mmio_graphics_write(u16 addr, u8 val) {
-    wormotron_graphics_write(g_wormotron->graphics, addr - WT_GRAPHICS_RAM_START, val);
+static void mmio_graphics_dirty(void* user, u16 addr) {
+    wormotron_t* wormotron = user;
+
+    wormotron_graphics_mark(
+        wormotron->graphics,
+        addr - WT_GRAPHICS_RAM_START,
+        SQUIRM_MMIO_PAGE_SIZE
+    );
 }
 
-static u8 mmio_graphics_read(u16 addr) {
-    return wormotron_graphics_read(g_wormotron->graphics, addr - WT_GRAPHICS_RAM_START);
+static void mmio_graphics_reg_write(void* user, u16 addr, u8 val) {
+    wormotron_t* wormotron = user;
+    u8 reg = (u8)(addr - WT_GRAPHICS_REG_START);
+    wormotron_graphics_write_reg(wormotron->graphics, reg, val);
+}
+
+static u8 mmio_graphics_reg_read(void* user, u16 addr) {
+    wormotron_t* wormotron = user;
+    u8 reg = (u8)(addr - WT_GRAPHICS_REG_START);
+    return wormotron_graphics_read_reg(wormotron->graphics, reg);
+}
+
+static void mmio_blitter_reg_write(void* user, u16 addr, u8 val) {
+    wormotron_t* wormotron = user;
+    u8 reg = (u8)(addr - WT_BLITTER_REG_START);
+    wormotron_blitter_write_reg(wormotron->blitter, reg, val);
+}
+
+static u8 mmio_blitter_reg_read(void* user, u16 addr) {
+    wormotron_t* wormotron = user;
+    u8 reg = (u8)(addr - WT_BLITTER_REG_START);
+    return wormotron_blitter_read_reg(wormotron->blitter, reg);
 }
 
 // clang-format off
-static squirm_mmio_entry_t k_mmio[] = {
+static const squirm_mmio_entry_t k_mmio[] = {
     {
         .start = 0xff00,
         .end = 0xff01,
@@ -60,19 +100,42 @@ static squirm_mmio_entry_t k_mmio[] = {
         .read = NULL
     },
     {
-        .start = WT_GRAPHICS_RAM_START,
-        .end = WT_GRAPHICS_RAM_START + WT_GRAPHICS_RAM_SIZE,
-        .write = mmio_graphics_write,
-        .read = mmio_graphics_read
+        .start = WT_GRAPHICS_REG_START,
+        .end = WT_GRAPHICS_REG_START + WT_GRAPHICS_REG_COUNT,
+        .write = mmio_graphics_reg_write,
+        .read = mmio_graphics_reg_read
+    },
+    {
+        .start = WT_BLITTER_REG_START,
+        .end = WT_BLITTER_REG_START + WT_BLITTER_REG_COUNT,
+        .write = mmio_blitter_reg_write,
+        .read = mmio_blitter_reg_read
     },
 };
 // clang-format on
 
-wormotron_t* wormotron_new(const char* rom_file) {
+wormotron_config_t wormotron_config_default(void) {
+    return (wormotron_config_t){
+        .ops_per_frame = WT_CPU_OPS_PER_FRAME,
+        .headless = false,
+        .frame_limit = 0,
+        .dump_every = 0,
+        .dump_dir = ".",
+        .dump_format = WT_GRAPHICS_DUMP_PPM,
+        .load_state = NULL,
+        .save_state = NULL,
+        .watch = false,
+    };
+}
+
+wormotron_t* wormotron_new(const char* rom_file, const wormotron_config_t* config) {
     LOG_DEBUG("Initializing wormotron...\n");
     wormotron_t* wormotron = malloc(sizeof(wormotron_t));
 
     wormotron->rom = wormotron_rom_load(rom_file);
+    wormotron->rom_file = rom_file;
+    wormotron->rom_mtime = 0;
+    wormotron->rom_file_size = 0;
     wormotron->cpu = squirm_cpu_new(
         (squirm_cpu_syscall_fn[]){
             syscall_exit,
@@ -81,91 +144,285 @@ wormotron_t* wormotron_new(const char* rom_file) {
         },
         3
     );
+    wormotron->cpu->user = wormotron;
+    wormotron->wait_for_present = false;
+
+    wormotron->graphics = wormotron_graphics_new(config->headless);
 
     for (usize i = 0; i < sizeof(k_mmio) / sizeof(k_mmio[0]); i++) {
-        squirm_cpu_add_mmio_entry(wormotron->cpu, k_mmio[i]);
+        squirm_mmio_entry_t entry = k_mmio[i];
+        entry.user = wormotron;
+        squirm_cpu_add_mmio_entry(wormotron->cpu, entry);
     }
 
+    // graphics RAM is mapped directly, so drawing costs the same as any other store. the
+    // graphics are told about each page that changed once per frame.
+    squirm_cpu_add_mmio_entry(
+        wormotron->cpu,
+        (squirm_mmio_entry_t){
+            .start = WT_GRAPHICS_RAM_START,
+            .end = WT_GRAPHICS_RAM_START + WT_GRAPHICS_RAM_SIZE,
+            .buffer = wormotron->graphics->ram,
+            .dirty = mmio_graphics_dirty,
+            .user = wormotron,
+        }
+    );
+
     LOG_DEBUG("MMIO entries: %d\n", wormotron->cpu->mmio_count);
 
     squirm_cpu_load(wormotron->cpu, wormotron->rom->data, wormotron->rom->size);
 
     squirm_cpu_reset(wormotron->cpu);
 
-    wormotron->graphics = wormotron_graphics_new();
+    wormotron->blitter = wormotron_blitter_new(wormotron->cpu);
+
+    wormotron->config = *config;
 
     return wormotron;
 }
 
 void wormotron_free(wormotron_t* wormotron) {
+    wormotron_blitter_free(wormotron->blitter);
     squirm_cpu_free(wormotron->cpu);
     wormotron_rom_free(wormotron->rom);
     free(wormotron);
 }
 
-// static int wormotron_cpu_thread(void* data) {
-//     wormotron_t* wormotron = (wormotron_t*)data;
-//
-//     while (!g_stop) {
-//         squirm_cpu_step(wormotron->cpu);
-//         if (wormotron->cpu->reg[BURROW_REG_FL] & BURROW_FL_FIN) {
-//             break;
-//         }
-//     }
-//
-//     g_stop = true;
-//
-//     return 0;
-// }
+// runs up to `config.ops_per_frame` instructions, stopping early when the program waits for a
+// present. blits count against the same budget. returns false once the program is done.
+static bool wormotron_run_frame(wormotron_t* wormotron) {
+    u64 remaining = wormotron->config.ops_per_frame;
+
+    while (remaining > 0) {
+        u64 executed = wormotron->cpu->executed_op_count;
+
+        if (squirm_cpu_run(wormotron->cpu, remaining) == SQUIRM_CPU_EXIT_FIN) {
+            return false;
+        }
+
+        u64 spent = wormotron->cpu->executed_op_count - executed +
+                    wormotron_blitter_take_cost(wormotron->blitter);
+        remaining = spent < remaining ? remaining - spent : 0;
+
+        if (wormotron->wait_for_present) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+// hands the frame to the render thread, and re-arms the dirty callbacks of graphics RAM
+static void wormotron_publish(wormotron_t* wormotron) {
+    wormotron_graphics_publish(wormotron->graphics);
+    squirm_cpu_clean(wormotron->cpu, WT_GRAPHICS_RAM_START, WT_GRAPHICS_RAM_SIZE);
+}
+
+// returns whether the ROM's file changed since the last call
+static bool wormotron_rom_file_changed(wormotron_t* wormotron) {
+    struct stat info;
+
+    // a file that's missing for a moment, while an editor saves it, counts as unchanged
+    if (stat(wormotron->rom_file, &info) != 0) {
+        return false;
+    }
+
+    i64 mtime = (i64)info.st_mtime;
+    i64 size = (i64)info.st_size;
+    bool changed = mtime != wormotron->rom_mtime || size != wormotron->rom_file_size;
+
+    wormotron->rom_mtime = mtime;
+    wormotron->rom_file_size = size;
+
+    return changed;
+}
+
+// reassembles the watched source and restarts the program with it. memory the new ROM
+// doesn't cover keeps its contents, graphics included. a source with errors keeps the old
+// program running.
+static void wormotron_reload(wormotron_t* wormotron) {
+    u64 start = SDL_GetPerformanceCounter();
+
+    wormotron_rom_t* rom = wormotron_rom_assemble(wormotron->rom_file);
+
+    if (rom == NULL) {
+        LOG_WARNING("Keeping the running program\n");
+        return;
+    }
+
+    wormotron_rom_free(wormotron->rom);
+    wormotron->rom = rom;
+
+    squirm_cpu_load(wormotron->cpu, rom->data, rom->size);
+    squirm_cpu_reset(wormotron->cpu);
+    wormotron->wait_for_present = false;
+
+    u64 elapsed = SDL_GetPerformanceCounter() - start;
+
+    LOG_INFO(
+        "Reloaded %s in %" PRIu64 " us\n",
+        wormotron->rom_file,
+        elapsed * 1000000 / SDL_GetPerformanceFrequency()
+    );
+}
+
+// runs the CPU a frame at a time and publishes every frame. host time is only read once per
+// frame, to pace the virtual clock to WT_FRAME_RATE.
+static int wormotron_cpu_thread(void* data) {
+    wormotron_t* wormotron = (wormotron_t*)data;
+
+    u64 frame_period = SDL_GetPerformanceFrequency() / WT_FRAME_RATE;
+    u64 deadline = SDL_GetPerformanceCounter() + frame_period;
+    u64 frame = 0;
+
+    // only records the state the source was loaded in
+    if (wormotron->config.watch) {
+        wormotron_rom_file_changed(wormotron);
+    }
+
+    while (!SDL_AtomicGet(&g_stop) && wormotron_run_frame(wormotron)) {
+        wormotron_publish(wormotron);
+
+        frame++;
+
+        if (wormotron->config.watch && frame % WT_WATCH_INTERVAL == 0 &&
+            wormotron_rom_file_changed(wormotron)) {
+            wormotron_reload(wormotron);
+        }
+
+        if (wormotron->wait_for_present) {
+            wormotron->wait_for_present = false;
+
+            // hold the program until the render thread took the frame
+            while (!SDL_AtomicGet(&g_stop) && wormotron_graphics_pending(wormotron->graphics)) {
+                SDL_Delay(1);
+            }
+
+            deadline = SDL_GetPerformanceCounter() + frame_period;
+            continue;
+        }
+
+        u64 now = SDL_GetPerformanceCounter();
+
+        if (now < deadline) {
+            SDL_Delay((u32)((deadline - now) * 1000 / SDL_GetPerformanceFrequency()));
+            deadline += frame_period;
+        } else {
+            // running behind, don't try to catch up
+            deadline = now + frame_period;
+        }
+    }
+
+    SDL_AtomicSet(&g_stop, 1);
+
+    return 0;
+}
+
+// runs CPU and rendering on the calling thread, so every frame is drawn and dumps are
+// deterministic
+static void wormotron_run_headless(wormotron_t* wormotron) {
+    const wormotron_config_t* config = &wormotron->config;
+    const char* extension = config->dump_format == WT_GRAPHICS_DUMP_RAW ? "rgba" : "ppm";
+
+    u64 frame = 0;
+    bool running = true;
+
+    while (!wormotron_should_stop() && running) {
+        running = wormotron_run_frame(wormotron);
+        wormotron->wait_for_present = false;
+
+        wormotron_publish(wormotron);
+        wormotron_graphics_acquire(wormotron->graphics);
+        wormotron_graphics_flush(wormotron->graphics);
+
+        frame++;
+
+        if (config->dump_every != 0 && frame % config->dump_every == 0) {
+            char path[4096];
+            snprintf(
+                path,
+                sizeof(path),
+                "%s/frame_%06" PRIu64 ".%s",
+                config->dump_dir,
+                frame,
+                extension
+            );
+            wormotron_graphics_dump(wormotron->graphics, path, config->dump_format);
+        }
+
+        if (config->frame_limit != 0 && frame >= config->frame_limit) {
+            break;
+        }
+    }
+
+    LOG_INFO(
+        "Ran %" PRIu64 " frames, %zu instructions.\n",
+        frame,
+        wormotron->cpu->executed_op_count
+    );
+}
+
+// saves the state once the CPU stopped, if asked to
+static void wormotron_save_state(wormotron_t* wormotron) {
+    if (wormotron->config.save_state == NULL) {
+        return;
+    }
+
+    wormotron_state_t* state = wormotron_state_capture(wormotron);
+    wormotron_state_save(wormotron, state, wormotron->config.save_state);
+    wormotron_state_free(state);
+}
 
 void wormotron_run(wormotron_t* wormotron) {
     LOG_INFO("Starting wormotron...\n");
 
-    // Start the CPU thread.
-    // SDL_Thread* cpu_thread =
-    //     SDL_CreateThread(wormotron_cpu_thread, "wormotron_cpu_thread", wormotron);
-    //
-    // if (cpu_thread == NULL) {
-    //     LOG_ERROR("Failed to create CPU thread: %s\n", SDL_GetError());
-    //     exit(1);
-    // }
+    if (wormotron->config.load_state != NULL) {
+        const char* path = wormotron->config.load_state;
+        wormotron_state_t* state = wormotron_state_load(wormotron, path);
+        wormotron_state_restore(wormotron, state);
+        wormotron_state_free(state);
+    }
+
+    if (wormotron->config.headless) {
+        wormotron_run_headless(wormotron);
+        wormotron_save_state(wormotron);
+        LOG_INFO("Exiting wormotron...\n");
+        return;
+    }
+
+    SDL_Thread* cpu_thread =
+        SDL_CreateThread(wormotron_cpu_thread, "wormotron_cpu_thread", wormotron);
+
+    if (cpu_thread == NULL) {
+        LOG_ERROR("Failed to create CPU thread: %s\n", SDL_GetError());
+        exit(1);
+    }
 
     LOG_DEBUG("CPU thread started.\n");
 
-    // Graphics loop.
+    // Render loop. Presenting waits for vsync, which only ever stalls this thread.
 
-    while (!g_stop) {
-        // Update the game state.
+    while (!wormotron_should_stop()) {
         SDL_Event event;
 
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
-                g_stop = true;
-            }
-        }
-
-        u32 start = SDL_GetTicks();
-
-        while (SDL_GetTicks() - start < 16) {
-            squirm_cpu_step(wormotron->cpu);
-            if (wormotron->cpu->reg[BURROW_REG_FL] & BURROW_FL_FIN) {
-                g_stop = true;
-                break;
-            }
-            if (g_wait_for_present) {
-                g_wait_for_present = false;
-                break;
+                SDL_AtomicSet(&g_stop, 1);
             }
         }
 
         wormotron_graphics_clear(wormotron->graphics);
 
-        wormotron_graphics_flush(wormotron->graphics);
+        if (wormotron_graphics_acquire(wormotron->graphics)) {
+            wormotron_graphics_flush(wormotron->graphics);
+        }
 
         wormotron_graphics_present(wormotron->graphics);
     }
 
     LOG_INFO("Exiting wormotron...\n");
 
-    // SDL_WaitThread(cpu_thread, NULL);
+    SDL_WaitThread(cpu_thread, NULL);
+
+    wormotron_save_state(wormotron);
 }
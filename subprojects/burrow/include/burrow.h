@@ -175,6 +175,57 @@ static inline u8 burrow_register_from_str(const char* str, size_t len) {
     return 0xff;
 }
 
+static inline const char* burrow_op_to_str(u8 op) {
+    switch (op) {
+        case BURROW_OP_NOP:
+            return "nop";
+        case BURROW_OP_LDI:
+            return "ldi";
+        case BURROW_OP_LDR:
+            return "ldr";
+        case BURROW_OP_LDRB:
+            return "ldrb";
+        case BURROW_OP_ADD:
+            return "add";
+        case BURROW_OP_SUB:
+            return "sub";
+        case BURROW_OP_MUL:
+            return "mul";
+        case BURROW_OP_DIV:
+            return "div";
+        case BURROW_OP_MOD:
+            return "mod";
+        case BURROW_OP_AND:
+            return "and";
+        case BURROW_OP_OR:
+            return "or";
+        case BURROW_OP_XOR:
+            return "xor";
+        case BURROW_OP_SHL:
+            return "shl";
+        case BURROW_OP_SHR:
+            return "shr";
+        case BURROW_OP_JMP:
+            return "jmp";
+        case BURROW_OP_JZ:
+            return "jz";
+        case BURROW_OP_JD:
+            return "jd";
+        case BURROW_OP_STI:
+            return "sti";
+        case BURROW_OP_STIB:
+            return "stib";
+        case BURROW_OP_STR:
+            return "str";
+        case BURROW_OP_STRB:
+            return "strb";
+        case BURROW_OP_SYS:
+            return "sys";
+        default:
+            return "??";
+    }
+}
+
 static inline const char* burrow_register_to_str(u8 reg) {
     if (reg <= BURROW_REG_Z) {
         return (const char[]){(char)(reg - BURROW_REG_A + 'a'), '\0'};
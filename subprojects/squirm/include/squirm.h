@@ -6,22 +6,127 @@
 
 #define SQUIRM_MEM_SIZE 0x10000
 
-typedef void (*squirm_mmio_write_fn)(u16 addr, u8 val);
-typedef u8 (*squirm_mmio_read_fn)(u16 addr);
+// MMIO callbacks are passed the `user` pointer of their entry
+typedef void (*squirm_mmio_write_fn)(void* user, u16 addr, u8 val);
+typedef u8 (*squirm_mmio_read_fn)(void* user, u16 addr);
+typedef void (*squirm_mmio_write16_fn)(void* user, u16 addr, u16 val);
+typedef u16 (*squirm_mmio_read16_fn)(void* user, u16 addr);
+typedef void (*squirm_mmio_write_range_fn)(void* user, u16 addr, const u8* data, u16 len);
+typedef void (*squirm_mmio_read_range_fn)(void* user, u16 addr, u8* data, u16 len);
+typedef void (*squirm_mmio_dirty_fn)(void* user, u16 addr);
 
 typedef struct squirm_cpu squirm_cpu_t;
 
 typedef void (*squirm_cpu_syscall_fn)(squirm_cpu_t* cpu);
 
+typedef struct squirm_op {
+    u8 op;
+    struct {
+        u8 dest;
+        u8 src_a;
+        u8 src_b;
+    } args;
+    u16 imm; // src_a and src_b combined, for reg-imm instructions
+} squirm_op_t;
+
+static inline squirm_op_t squirm_op_new(u8 op, u8 dest, u8 src_a, u8 src_b) {
+    return (squirm_op_t){
+        .op = op,
+        .args = { .dest = dest, .src_a = src_a, .src_b = src_b },
+        .imm = (u16)((src_a << 8) | src_b),
+    };
+}
+
+typedef void (*squirm_cpu_op_fn)(squirm_cpu_t* cpu, squirm_op_t op);
+
+// superinstructions `squirm_cpu_run` dispatches to in place of a pair of ops
+typedef enum squirm_fused_op {
+    // `ldi` followed by each of the ALU ops, in opcode order
+    SQUIRM_FUSED_LDI_ADD = BURROW_OP_COUNT,
+    SQUIRM_FUSED_LDI_SUB,
+    SQUIRM_FUSED_LDI_MUL,
+    SQUIRM_FUSED_LDI_DIV,
+    SQUIRM_FUSED_LDI_MOD,
+    SQUIRM_FUSED_LDI_AND,
+    SQUIRM_FUSED_LDI_OR,
+    SQUIRM_FUSED_LDI_XOR,
+    SQUIRM_FUSED_LDI_SHL,
+    SQUIRM_FUSED_LDI_SHR,
+    SQUIRM_FUSED_SUB_JZ,
+    SQUIRM_FUSED_JZ_JMP,
+    SQUIRM_DISPATCH_COUNT,
+} squirm_fused_op_t;
+
+// a pre-decoded instruction slot. `handler` is NULL until the slot is decoded,
+// and is reset to NULL whenever the underlying code memory is written to.
+typedef struct squirm_decoded_op {
+    squirm_cpu_op_fn handler;
+    squirm_op_t op;
+    // what `squirm_cpu_run` dispatches on: the opcode, or a superinstruction covering this
+    // op and the next one. only meaningful within a block.
+    u8 dispatch;
+} squirm_decoded_op_t;
+
+#define SQUIRM_DECODED_OP_COUNT ((BURROW_MEM_CODE_END - BURROW_MEM_CODE_START + 1) / 4)
+
+#define SQUIRM_CODE_PAGE_SIZE 0x100
+#define SQUIRM_CODE_PAGE_COUNT                                                                 \
+    ((BURROW_MEM_CODE_END - BURROW_MEM_CODE_START + 1) / SQUIRM_CODE_PAGE_SIZE)
+
+// a basic block of the code region: a run of pre-decoded ops in `decoded`, starting at
+// `start` and ending at a branch, `sys`, a write to %ip or the end of the code page.
+typedef struct squirm_block {
+    u16 start;
+    u16 len; // number of ops, 0 if the block isn't built
+    u32 gen; // code page generation the block was built from
+    // successors, chained once they have been looked up
+    struct squirm_block* next;  // when execution falls through the end of the block
+    struct squirm_block* taken; // when the last op branched away
+} squirm_block_t;
+
 typedef struct squirm_mmio_entry {
     u16 start;
     u16 end;
     squirm_mmio_write_fn write;
     squirm_mmio_read_fn read;
+    // optional, used instead of two `write`/`read` calls when present.
+    // `write16` must behave like writing the high byte to `addr` and the low byte to
+    // `addr + 1`, `read16` like reading the low byte from `addr` and the high byte from
+    // `addr + 1`.
+    squirm_mmio_write16_fn write16;
+    squirm_mmio_read16_fn read16;
+    // optional, used by `squirm_cpu_write_range` instead of one `write` call per byte
+    squirm_mmio_write_range_fn write_range;
+    // optional, used by `squirm_cpu_read_range` instead of one `read` call per byte
+    squirm_mmio_read_range_fn read_range;
+    // optional, maps the entry directly onto `end - start` bytes of host memory. loads and
+    // stores then access it like plain memory, in the byte order of the callbacks above,
+    // without calling them or leaving `squirm_cpu_run`. the byte past the end of the entry
+    // is ignored by 16-bit stores and reads as 0.
+    u8* buffer;
+    // optional for direct-mapped entries, called with the start of a page the first time it
+    // is stored to after the page was cleaned, see `squirm_cpu_clean`
+    squirm_mmio_dirty_fn dirty;
+    void* user; // host data passed to the callbacks
 } squirm_mmio_entry_t;
 
 #define SQUIRM_MMIO_MAX 16
 
+// MMIO lookups go through a map of 256-byte memory pages
+#define SQUIRM_MMIO_PAGE_SIZE 0x100
+#define SQUIRM_MMIO_PAGE_COUNT (SQUIRM_MEM_SIZE / SQUIRM_MMIO_PAGE_SIZE)
+#define SQUIRM_MMIO_PAGE_NONE 0     // plain memory
+#define SQUIRM_MMIO_PAGE_MIXED 0xff // only partially covered, entries are scanned
+
+// an error in the program that stopped the CPU
+typedef enum squirm_cpu_fault {
+    SQUIRM_CPU_FAULT_NONE,
+    SQUIRM_CPU_FAULT_DIV_ZERO,
+    SQUIRM_CPU_FAULT_INVALID_SYSCALL,
+    SQUIRM_CPU_FAULT_INVALID_OP,
+    SQUIRM_CPU_FAULT_UNALIGNED_IP,
+} squirm_cpu_fault_t;
+
 typedef struct squirm_cpu {
     u16 reg[BURROW_REG_COUNT];
     u8 mem[SQUIRM_MEM_SIZE];
@@ -29,30 +134,85 @@ typedef struct squirm_cpu {
 
     squirm_mmio_entry_t mmio[SQUIRM_MMIO_MAX];
     u16 mmio_count;
+    // per page: SQUIRM_MMIO_PAGE_NONE, SQUIRM_MMIO_PAGE_MIXED or the index of the single
+    // entry covering the whole page plus one
+    u8 mmio_page[SQUIRM_MMIO_PAGE_COUNT];
+    bool mmio_accessed; // set whenever a load or store hits an MMIO entry, unless it's direct
+    // per page: stored to through a direct-mapped entry since it was last cleaned
+    u64 mmio_dirty[SQUIRM_MMIO_PAGE_COUNT / 64];
+
+    // the arithmetic flags of %fl are computed lazily from the last ALU op.
+    // `flags_op` is BURROW_OP_NOP when %fl is up to date, see `squirm_cpu_sync_flags`.
+    u8 flags_op;
+    u16 flags_a;
+    u16 flags_b;
+    u16 flags_result;
+
+    // set along with FIN when the program faults, cleared by `squirm_cpu_reset`
+    squirm_cpu_fault_t fault;
 
     squirm_cpu_syscall_fn syscalls[BURROW_SYS_MAX_SYSCALLS];
     u16 syscall_count;
+    void* user; // host data for syscalls, NULL unless the host sets it
+
+    // decode cache for the code region
+    squirm_decoded_op_t decoded[SQUIRM_DECODED_OP_COUNT];
+    // bumped whenever a code page is written to, so translations can tell they are stale
+    u32 code_page_gen[SQUIRM_CODE_PAGE_COUNT];
+    // basic blocks by start slot, see `squirm_block_t`
+    squirm_block_t blocks[SQUIRM_DECODED_OP_COUNT];
 } squirm_cpu_t;
 
-typedef struct squirm_op {
-    u8 op;
-    struct {
-        u8 dest;
-        u8 src_a;
-        u8 src_b;
-    } args;
-} squirm_op_t;
+// memory is snapshotted in pages, only keeping the ones that differ from a base image
+#define SQUIRM_SNAPSHOT_PAGE_SIZE 0x100
+#define SQUIRM_SNAPSHOT_PAGE_COUNT (SQUIRM_MEM_SIZE / SQUIRM_SNAPSHOT_PAGE_SIZE)
 
-typedef void (*squirm_cpu_op_fn)(squirm_cpu_t* cpu, squirm_op_t op);
+// the state of a CPU, see `squirm_cpu_snapshot`. MMIO entries and syscalls belong to the
+// host and aren't part of it.
+typedef struct squirm_snapshot {
+    u16 reg[BURROW_REG_COUNT]; // with %fl up to date
+    u64 executed_op_count;
+    u64 pages[SQUIRM_SNAPSHOT_PAGE_COUNT / 64]; // pages that differ from the base image
+    u16 page_count;
+    u8 data[]; // `page_count` pages, in address order
+} squirm_snapshot_t;
+
+// why `squirm_cpu_run` returned control to the host
+typedef enum squirm_cpu_exit {
+    SQUIRM_CPU_EXIT_BUDGET,  // ran `max_ops` instructions
+    SQUIRM_CPU_EXIT_FIN,     // the FIN flag is set, `fault` tells whether the program faulted
+    SQUIRM_CPU_EXIT_SYSCALL, // a syscall was executed
+    SQUIRM_CPU_EXIT_MMIO,    // a load or store went through an MMIO entry
+} squirm_cpu_exit_t;
 
 #define OP_HANDLER_NAME(OP) squirm_cpu_op_##OP
-#define OP_HANDLER(OP) static void OP_HANDLER_NAME(OP)(squirm_cpu_t * cpu, squirm_op_t op)
+// inline, so that `squirm_cpu_run` can fold the handlers into its dispatch loop
+#define OP_HANDLER(OP)                                                                         \
+    static inline void OP_HANDLER_NAME(OP)(squirm_cpu_t * cpu, squirm_op_t op)
 
 squirm_cpu_t* squirm_cpu_new(squirm_cpu_syscall_fn* syscalls, u16 num_sys);
 void squirm_cpu_free(squirm_cpu_t* cpu);
 void squirm_cpu_add_mmio_entry(squirm_cpu_t* cpu, squirm_mmio_entry_t entry);
 void squirm_cpu_reset(squirm_cpu_t* cpu);
+const char* squirm_cpu_fault_str(squirm_cpu_fault_t fault);
 void squirm_cpu_load(squirm_cpu_t* cpu, u8* data, u16 size);
 void squirm_cpu_load_at(squirm_cpu_t* cpu, u16 addr, u8* data, u16 size);
+void squirm_cpu_invalidate(squirm_cpu_t* cpu, u16 addr, u16 size);
+void squirm_cpu_write_range(squirm_cpu_t* cpu, u16 addr, const u8* data, u16 len);
+void squirm_cpu_read_range(squirm_cpu_t* cpu, u16 addr, u8* data, u16 len);
+void squirm_cpu_clean(squirm_cpu_t* cpu, u16 addr, u16 len);
+void squirm_cpu_sync_flags(squirm_cpu_t* cpu);
 squirm_op_t squirm_cpu_decode_op(squirm_cpu_t* cpu);
+u8 squirm_cpu_fuse(squirm_op_t first, squirm_op_t second);
+void squirm_cpu_exec(squirm_cpu_t* cpu, squirm_op_t op);
 void squirm_cpu_step(squirm_cpu_t* cpu);
+squirm_cpu_exit_t squirm_cpu_run(squirm_cpu_t* cpu, usize max_ops);
+
+squirm_snapshot_t* squirm_cpu_snapshot(squirm_cpu_t* cpu, const u8* base, u32 base_size);
+void squirm_cpu_restore(
+    squirm_cpu_t* cpu,
+    const squirm_snapshot_t* snapshot,
+    const u8* base,
+    u32 base_size
+);
+void squirm_snapshot_free(squirm_snapshot_t* snapshot);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "squirm.h"
+#include "types.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+// bytes of `print` output kept per task, the rest is dropped
+#define SQUIRM_BATCH_OUTPUT_MAX 0x1000
+
+// a single run of a ROM, and what came out of it
+typedef struct squirm_batch_task {
+    const char* rom_file;
+    u8* rom; // shared between the tasks of a ROM, never written to
+    u32 rom_size;
+    bool seeded;
+    u16 seed; // loaded into %a before the first instruction, if `seeded`
+
+    // results
+    u64 executed_op_count;
+    bool finished;            // false if the run hit the instruction limit
+    squirm_cpu_fault_t fault; // why the program stopped, if it faulted
+    u64 wall_us;
+    char output[SQUIRM_BATCH_OUTPUT_MAX];
+    u16 output_len;
+    bool output_truncated;
+} squirm_batch_task_t;
+
+// the tasks a worker owns. the owner pops from the front, idle workers steal from the back.
+typedef struct squirm_batch_queue {
+    pthread_mutex_t lock;
+    usize head;
+    usize tail;
+} squirm_batch_queue_t;
+
+// runs independent tasks on a pool of threads, each on a CPU of its own. queues start out
+// as equal slices of the task list, so a worker only contends for a lock once it ran out of
+// its own tasks.
+typedef struct squirm_batch {
+    squirm_batch_task_t* tasks;
+    usize task_count;
+    u64 max_ops; // per task, 0 runs until the program exits
+
+    u32 thread_count;
+    squirm_batch_queue_t* queues; // one per thread
+
+    // results are written as JSON lines as soon as a task is done
+    FILE* out;
+    pthread_mutex_t out_lock;
+} squirm_batch_t;
+
+squirm_batch_t* squirm_batch_new(
+    squirm_batch_task_t* tasks,
+    usize task_count,
+    u32 thread_count,
+    u64 max_ops,
+    FILE* out
+);
+void squirm_batch_free(squirm_batch_t* batch);
+
+void squirm_batch_run(squirm_batch_t* batch);
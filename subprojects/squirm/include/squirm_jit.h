@@ -0,0 +1,64 @@
+#pragma once
+
+#include "burrow.h"
+#include "squirm.h"
+#include "types.h"
+
+// x86-64 JIT backend for `squirm`.
+//
+// Only built when squirm is configured with `-Djit=true`, which defines SQUIRM_JIT.
+//
+// Basic blocks of burrow code (ending at `jmp`, `jz`, `jd` or before `sys`) are translated
+// into native code in an mmap'd executable buffer. The register file stays pinned in the
+// `squirm_cpu_t` struct, which the generated code addresses through a host register. Only
+// %fl is cached in a host register, since nearly every instruction touches it.
+// Blocks chain directly into each other once their successors are translated.
+//
+// Loads and stores go through the interpreter, so MMIO behaves exactly as in
+// `squirm_cpu_run`. Stores into code memory bump the page generation of the CPU, which
+// makes every translation of that page stale. Anything the JIT can't translate (`sys`,
+// invalid opcodes, code outside of the code region) is run by the interpreter.
+
+#define SQUIRM_JIT_CODE_SIZE 0x400000
+#define SQUIRM_JIT_MAX_BLOCK_OPS 64
+
+typedef u32 (*squirm_jit_entry_fn)(squirm_cpu_t* cpu, const u8* code, usize* budget);
+
+typedef struct squirm_jit_block {
+    u8* entry; // NULL if the block starts with an instruction the JIT can't translate
+    u32 gen;   // code page generation the block was translated from
+    bool valid;
+} squirm_jit_block_t;
+
+// a `jmp rel32` to a block that wasn't translated yet, patched once it is
+typedef struct squirm_jit_link {
+    u32 site; // offset of the jump in the code buffer
+    u32 next; // next link waiting for the same target, plus one
+} squirm_jit_link_t;
+
+typedef struct squirm_jit {
+    squirm_cpu_t* cpu;
+
+    u8* code;
+    usize code_len;
+    usize code_start; // end of the trampoline and exit stubs, where blocks begin
+
+    squirm_jit_entry_fn enter;
+    u8* exit_budget;
+    u8* exit_mmio;
+    u8* exit_dispatch;
+
+    squirm_jit_block_t blocks[SQUIRM_DECODED_OP_COUNT];
+    // block entries by slot, read by the generated code for `jd`
+    u8* native[SQUIRM_DECODED_OP_COUNT];
+
+    u32 link_heads[SQUIRM_DECODED_OP_COUNT];
+    squirm_jit_link_t* links;
+    usize links_len;
+    usize links_cap;
+} squirm_jit_t;
+
+squirm_jit_t* squirm_jit_new(squirm_cpu_t* cpu);
+void squirm_jit_free(squirm_jit_t* jit);
+void squirm_jit_flush(squirm_jit_t* jit);
+squirm_cpu_exit_t squirm_jit_run(squirm_jit_t* jit, usize max_ops);
@@ -4,52 +4,154 @@
 #include "log.h"
 #include "types.h"
 #include "squirm.h"
+#ifndef _WIN32
+#include "squirm_batch.h"
+#endif
 #include "squirm_dbg.h"
+#ifdef SQUIRM_JIT
+#include "squirm_jit.h"
+#endif
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #ifndef _WIN32
 #include <sys/time.h>
+#include <unistd.h>
 #endif
 #include <time.h>
 
+// instructions executed per `squirm_cpu_run` call
+#define SQUIRM_CLI_RUN_BUDGET 0x100000
+
+// opcode pairs listed by `--profile`
+#define SQUIRM_CLI_PROFILE_TOP 20
+
+// instructions `--check-jit` runs between comparing the JIT to the interpreter
+#define SQUIRM_CLI_CHECK_BUDGET 0x100
+
 typedef struct args {
     char* rom_file;
     bool debug;
+    bool jit;
+    bool check_jit; // runs the JIT and the interpreter side by side
+    bool profile;
+
+    // batch mode runs every ROM given, once per seed
+    bool batch;
+    char** rom_files;
+    int rom_count;
+    u32 seeds;   // 0 runs each ROM once, without a seed
+    u32 threads; // 0 uses one per online core
+    u64 max_ops; // per run, 0 runs until the program exits
 } args_t;
 
 static void usage(void) {
-    printf("Usage: squirm <rom_file> [-d, --debug]\n");
+    printf(
+        "Usage: squirm <rom_file> [-d, --debug] [-j, --jit] [-c, --check-jit] [-p, --profile]\n"
+        "       squirm -b, --batch <rom_file>... [--seeds <count>] [-t, --threads <count>]\n"
+        "              [--max-ops <count>]\n"
+    );
+}
+
+// returns the value of the option at `argv[*i]` and skips over it
+static char* option_value(int argc, char* argv[], int* i) {
+    if (*i + 1 >= argc) {
+        usage();
+        exit(1);
+    }
+
+    return argv[++*i];
+}
+
+static u64 parse_count(const char* value, const char* what, u64 max) {
+    char* end = NULL;
+    unsigned long long count = strtoull(value, &end, 0);
+
+    if (*value == '\0' || *end != '\0' || count > max) {
+        LOG_ERROR("Invalid %s: %s\n", what, value);
+        exit(1);
+    }
+
+    return (u64)count;
 }
 
 static args_t parse_args(int argc, char* argv[]) {
     args_t args = {0};
-    if (argc < 2 || argc > 3) {
+    if (argc < 2) {
         usage();
         exit(1);
     }
 
-    bool rom_file_exists = false;
+    args.rom_files = malloc(sizeof(char*) * (usize)argc);
+
+    if (args.rom_files == NULL) {
+        LOG_ERROR("Failed to allocate memory for arguments\n");
+        exit(1);
+    }
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0) {
             args.debug = true;
-        } else if (!rom_file_exists) {
-            args.rom_file = argv[i];
-            rom_file_exists = true;
-        } else {
+        } else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jit") == 0) {
+            args.jit = true;
+        } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--check-jit") == 0) {
+            args.check_jit = true;
+        } else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--profile") == 0) {
+            args.profile = true;
+        } else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--batch") == 0) {
+            args.batch = true;
+        } else if (strcmp(argv[i], "--seeds") == 0) {
+            // seeds are loaded into a 16-bit register
+            char* value = option_value(argc, argv, &i);
+            args.seeds = (u32)parse_count(value, "seed count", 0x10000);
+        } else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) {
+            char* value = option_value(argc, argv, &i);
+            args.threads = (u32)parse_count(value, "thread count", 1024);
+        } else if (strcmp(argv[i], "--max-ops") == 0) {
+            char* value = option_value(argc, argv, &i);
+            args.max_ops = parse_count(value, "instruction limit", UINT64_MAX);
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
             usage();
             exit(1);
+        } else {
+            args.rom_files[args.rom_count++] = argv[i];
         }
     }
 
-    if (!rom_file_exists) {
+    if (args.rom_count == 0 || (!args.batch && args.rom_count > 1)) {
         usage();
         exit(1);
     }
 
+    args.rom_file = args.rom_files[0];
+
+    if (args.batch && (args.debug || args.jit || args.check_jit || args.profile)) {
+        LOG_ERROR("--batch can't be combined with --debug, --jit, --check-jit or --profile\n");
+        exit(1);
+    }
+
+    if (!args.batch && (args.seeds != 0 || args.threads != 0 || args.max_ops != 0)) {
+        LOG_ERROR("--seeds, --threads and --max-ops need --batch\n");
+        exit(1);
+    }
+
+#ifndef SQUIRM_JIT
+    if (args.jit || args.check_jit) {
+        LOG_ERROR("squirm was built without the JIT, reconfigure with -Djit=true\n");
+        exit(1);
+    }
+#endif
+
+#ifdef _WIN32
+    if (args.batch) {
+        LOG_ERROR("--batch runs on pthreads, which aren't available on Windows\n");
+        exit(1);
+    }
+#endif
+
     return args;
 }
 
@@ -70,17 +172,135 @@ static void syscall_print(squirm_cpu_t* cpu) {
     cpu->reg[BURROW_REG_A] = 0;
 }
 
-int main(int argc, char* argv[]) {
-    // init logging
+#ifdef SQUIRM_JIT
+// keeps %a as `print` leaves it, without writing the output a second time
+static void syscall_print_silent(squirm_cpu_t* cpu) {
+    cpu->reg[BURROW_REG_A] = 0;
+}
 
-    log_init();
+// runs the program under the JIT, and steps a second CPU through the same instructions with
+// the interpreter. returns false at the first point their registers or memory differ.
+static bool check_jit_run(squirm_cpu_t* cpu, u8* rom, u32 rom_size) {
+    squirm_cpu_t* ref =
+        squirm_cpu_new((squirm_cpu_syscall_fn[]){ syscall_exit, syscall_print_silent }, 2);
+    squirm_cpu_load(ref, rom, (u16)rom_size);
+    squirm_cpu_reset(ref);
 
-    args_t args = parse_args(argc, argv);
+    squirm_jit_t* jit = squirm_jit_new(cpu);
+    bool same = true;
 
-    FILE* rom_file = fopen(args.rom_file, "r");
+    while (same && !(cpu->reg[BURROW_REG_FL] & BURROW_FL_FIN)) {
+        squirm_jit_run(jit, SQUIRM_CLI_CHECK_BUDGET);
+
+        while (ref->executed_op_count < cpu->executed_op_count &&
+               !(ref->reg[BURROW_REG_FL] & BURROW_FL_FIN)) {
+            squirm_cpu_step(ref);
+        }
+
+        squirm_cpu_sync_flags(cpu);
+        squirm_cpu_sync_flags(ref);
+
+        if (ref->executed_op_count != cpu->executed_op_count) {
+            LOG_ERROR(
+                "JIT ran %zu instructions, the interpreter stopped after %zu\n",
+                cpu->executed_op_count,
+                ref->executed_op_count
+            );
+            same = false;
+        }
+
+        for (u8 reg = 0; reg < BURROW_REG_COUNT; reg++) {
+            if (cpu->reg[reg] != ref->reg[reg]) {
+                LOG_ERROR(
+                    "register %02x differs after %zu instructions: JIT %04x, reference %04x\n",
+                    reg,
+                    cpu->executed_op_count,
+                    cpu->reg[reg],
+                    ref->reg[reg]
+                );
+                same = false;
+            }
+        }
+
+        if (memcmp(cpu->mem, ref->mem, sizeof(cpu->mem)) != 0) {
+            LOG_ERROR("memory differs after %zu instructions\n", cpu->executed_op_count);
+            same = false;
+        }
+    }
+
+    if (same) {
+        LOG_INFO("JIT matches the interpreter\n");
+    }
+
+    squirm_jit_free(jit);
+    squirm_cpu_free(ref);
+
+    return same;
+}
+#endif
+
+// steps through the whole program, counting how often each opcode follows another
+static void profile_run(squirm_cpu_t* cpu) {
+    static u64 pairs[BURROW_OP_COUNT][BURROW_OP_COUNT];
+
+    u8 prev = BURROW_OP_COUNT;
+
+    while (!(cpu->reg[BURROW_REG_FL] & BURROW_FL_FIN)) {
+        u8 op = cpu->mem[cpu->reg[BURROW_REG_IP]];
+
+        if (op < BURROW_OP_COUNT && prev < BURROW_OP_COUNT) {
+            pairs[prev][op]++;
+        }
+
+        squirm_cpu_step(cpu);
+        prev = op;
+    }
+
+    printf("top opcode pairs (* = fused):\n");
+
+    // selection of the most frequent remaining pair, the table is tiny
+    for (int n = 0; n < SQUIRM_CLI_PROFILE_TOP; n++) {
+        u8 first = 0;
+        u8 second = 0;
+
+        for (u8 a = 0; a < BURROW_OP_COUNT; a++) {
+            for (u8 b = 0; b < BURROW_OP_COUNT; b++) {
+                if (pairs[a][b] > pairs[first][second]) {
+                    first = a;
+                    second = b;
+                }
+            }
+        }
+
+        u64 count = pairs[first][second];
+
+        if (count == 0) {
+            break;
+        }
+
+        // operands decide some fusions, so only the opcodes are checked here
+        squirm_op_t a = squirm_op_new(first, BURROW_REG_A, 0, 0);
+        squirm_op_t b = squirm_op_new(second, BURROW_REG_A, 0, 0);
+        bool fused = squirm_cpu_fuse(a, b) != first;
+
+        printf(
+            "  %-4s %-4s %12" PRIu64 "  %5.2f%% %s\n",
+            burrow_op_to_str(first),
+            burrow_op_to_str(second),
+            count,
+            100.0 * (double)count / (double)cpu->executed_op_count,
+            fused ? "*" : ""
+        );
+
+        pairs[first][second] = 0;
+    }
+}
+
+static u8* load_rom(const char* path, u32* size) {
+    FILE* rom_file = fopen(path, "r");
 
     if (rom_file == NULL) {
-        LOG_ERROR("Failed to open rom file: %s\n", args.rom_file);
+        LOG_ERROR("Failed to open rom file: %s\n", path);
         exit(1);
     }
 
@@ -91,7 +311,7 @@ int main(int argc, char* argv[]) {
     fseek(rom_file, 0, SEEK_SET);
 
     if (rom_size > 0x10000) {
-        LOG_ERROR("Rom file too large: %s\n", args.rom_file);
+        LOG_ERROR("Rom file too large: %s\n", path);
         exit(1);
     }
 
@@ -100,7 +320,7 @@ int main(int argc, char* argv[]) {
     u8* rom = malloc(rom_size);
 
     if (rom == NULL) {
-        LOG_ERROR("Failed to allocate memory for rom: %s\n", args.rom_file);
+        LOG_ERROR("Failed to allocate memory for rom: %s\n", path);
         exit(1);
     }
 
@@ -108,6 +328,84 @@ int main(int argc, char* argv[]) {
 
     fclose(rom_file);
 
+    *size = rom_size;
+
+    return rom;
+}
+
+#ifndef _WIN32
+// runs every ROM once per seed across a pool of threads, writing a JSON line per run to
+// stdout
+static void batch_run(const args_t* args) {
+    u32 runs_per_rom = args->seeds != 0 ? args->seeds : 1;
+    usize task_count = (usize)args->rom_count * runs_per_rom;
+    squirm_batch_task_t* tasks = calloc(task_count, sizeof(squirm_batch_task_t));
+    u8** roms = malloc(sizeof(u8*) * (usize)args->rom_count);
+
+    if (tasks == NULL || roms == NULL) {
+        LOG_ERROR("Failed to allocate memory for batch tasks\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < args->rom_count; i++) {
+        u32 rom_size;
+        roms[i] = load_rom(args->rom_files[i], &rom_size);
+
+        for (u32 seed = 0; seed < runs_per_rom; seed++) {
+            squirm_batch_task_t* task = &tasks[(usize)i * runs_per_rom + seed];
+
+            task->rom_file = args->rom_files[i];
+            task->rom = roms[i];
+            task->rom_size = rom_size;
+            task->seeded = args->seeds != 0;
+            task->seed = (u16)seed;
+        }
+    }
+
+    u32 threads = args->threads;
+
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (u32)cores : 1;
+    }
+
+    squirm_batch_t* batch = squirm_batch_new(tasks, task_count, threads, args->max_ops, stdout);
+
+    LOG_INFO("Running %zu tasks on %u threads\n", task_count, batch->thread_count);
+
+    squirm_batch_run(batch);
+    squirm_batch_free(batch);
+
+    for (int i = 0; i < args->rom_count; i++) {
+        free(roms[i]);
+    }
+
+    free(roms);
+    free(tasks);
+}
+#endif
+
+int main(int argc, char* argv[]) {
+    // init logging
+
+    log_init();
+
+    args_t args = parse_args(argc, argv);
+
+#ifndef _WIN32
+    if (args.batch) {
+        batch_run(&args);
+
+        free(args.rom_files);
+        log_close();
+
+        return 0;
+    }
+#endif
+
+    u32 rom_size;
+    u8* rom = load_rom(args.rom_file, &rom_size);
+
     if (args.debug) {
         dump_buffer(rom, rom_size, 4);
     }
@@ -119,6 +417,7 @@ int main(int argc, char* argv[]) {
     squirm_cpu_reset(cpu);
 
     squirm_dbg_t* dbg = NULL;
+    bool checked = true;
 
     if (args.debug) {
         LOG_INFO("Debugging enabled\n");
@@ -133,12 +432,23 @@ int main(int argc, char* argv[]) {
 
     if (args.debug) {
         squirm_dbg_run(dbg);
+    } else if (args.profile) {
+        profile_run(cpu);
+#ifdef SQUIRM_JIT
+    } else if (args.check_jit) {
+        checked = check_jit_run(cpu, rom, rom_size);
+    } else if (args.jit) {
+        squirm_jit_t* jit = squirm_jit_new(cpu);
+
+        while (squirm_jit_run(jit, SQUIRM_CLI_RUN_BUDGET) != SQUIRM_CPU_EXIT_FIN) {
+            // syscalls and MMIO need no extra handling from the CLI
+        }
+
+        squirm_jit_free(jit);
+#endif
     } else {
-        while (1) {
-            squirm_cpu_step(cpu);
-            if (cpu->reg[BURROW_REG_FL] & BURROW_FL_FIN) {
-                break;
-            }
+        while (squirm_cpu_run(cpu, SQUIRM_CLI_RUN_BUDGET) != SQUIRM_CPU_EXIT_FIN) {
+            // syscalls and MMIO need no extra handling from the CLI
         }
     }
 
@@ -156,14 +466,18 @@ int main(int argc, char* argv[]) {
     LOG_INFO("Calculated frequency: %ld Hz\n", cpu->executed_op_count * 1000000 / elapsed);
 #endif
 
+    // a program that faulted, or ran differently under the JIT, exits with an error
+    int status = cpu->fault != SQUIRM_CPU_FAULT_NONE || !checked ? 1 : 0;
+
     if (args.debug) {
         squirm_dbg_free(dbg);
     }
     squirm_cpu_free(cpu);
 
     free(rom);
+    free(args.rom_files);
 
     log_close();
 
-    return 0;
+    return status;
 }
@@ -28,8 +28,19 @@ squirm_cpu_t* squirm_cpu_new(squirm_cpu_syscall_fn* syscalls, u16 num_sys) {
     }
 
     cpu->syscall_count = num_sys;
+    cpu->user = NULL;
+    cpu->fault = SQUIRM_CPU_FAULT_NONE;
+
+    cpu->flags_op = BURROW_OP_NOP;
 
     cpu->mmio_count = 0;
+    memset(cpu->mmio_page, SQUIRM_MMIO_PAGE_NONE, sizeof(cpu->mmio_page));
+    cpu->mmio_accessed = false;
+    memset(cpu->mmio_dirty, 0, sizeof(cpu->mmio_dirty));
+
+    memset(cpu->decoded, 0, sizeof(cpu->decoded));
+    memset(cpu->code_page_gen, 0, sizeof(cpu->code_page_gen));
+    memset(cpu->blocks, 0, sizeof(cpu->blocks));
 
     return cpu;
 }
@@ -40,7 +51,28 @@ void squirm_cpu_add_mmio_entry(squirm_cpu_t* cpu, squirm_mmio_entry_t entry) {
         exit(1);
     }
 
+    u8 index = (u8)cpu->mmio_count;
     cpu->mmio[cpu->mmio_count++] = entry;
+
+    if (entry.end <= entry.start) {
+        return;
+    }
+
+    u16 first = entry.start / SQUIRM_MMIO_PAGE_SIZE;
+    u16 last = (entry.end - 1) / SQUIRM_MMIO_PAGE_SIZE;
+
+    for (u16 page = first; page <= last; page++) {
+        u32 page_start = page * SQUIRM_MMIO_PAGE_SIZE;
+        u32 page_end = page_start + SQUIRM_MMIO_PAGE_SIZE;
+        bool covered = entry.start <= page_start && page_end <= entry.end;
+
+        // earlier entries take precedence, so sharing a page always means a scan
+        if (covered && cpu->mmio_page[page] == SQUIRM_MMIO_PAGE_NONE) {
+            cpu->mmio_page[page] = index + 1;
+        } else {
+            cpu->mmio_page[page] = SQUIRM_MMIO_PAGE_MIXED;
+        }
+    }
     LOG_DEBUG("added MMIO entry from %04X to %04X\n", entry.start, entry.end);
 }
 
@@ -56,16 +88,66 @@ void squirm_cpu_reset(squirm_cpu_t* cpu) {
     cpu->reg[BURROW_REG_IP] = BURROW_MEM_CODE_START;
     cpu->reg[BURROW_REG_SP] = BURROW_MEM_STACK_START;
     cpu->reg[BURROW_REG_FL] = BURROW_FL_NONE;
+    cpu->flags_op = BURROW_OP_NOP;
 
     cpu->executed_op_count = 0;
+    cpu->fault = SQUIRM_CPU_FAULT_NONE;
+}
+
+const char* squirm_cpu_fault_str(squirm_cpu_fault_t fault) {
+    switch (fault) {
+        case SQUIRM_CPU_FAULT_NONE:
+            return "none";
+        case SQUIRM_CPU_FAULT_DIV_ZERO:
+            return "division by zero";
+        case SQUIRM_CPU_FAULT_INVALID_SYSCALL:
+            return "invalid syscall";
+        case SQUIRM_CPU_FAULT_INVALID_OP:
+            return "invalid opcode";
+        case SQUIRM_CPU_FAULT_UNALIGNED_IP:
+            return "unaligned instruction pointer";
+    }
+
+    return "unknown fault";
 }
 
 void squirm_cpu_load(squirm_cpu_t* cpu, u8* data, u16 size) {
     memcpy(cpu->mem, data, size);
+    squirm_cpu_invalidate(cpu, 0, size);
 }
 
 void squirm_cpu_load_at(squirm_cpu_t* cpu, u16 addr, u8* data, u16 size) {
     memcpy(cpu->mem + addr, data, size);
+    squirm_cpu_invalidate(cpu, addr, size);
+}
+
+static inline void squirm_cpu_invalidate_byte(squirm_cpu_t* cpu, u16 addr) {
+    if (addr <= BURROW_MEM_CODE_END) {
+        cpu->decoded[addr / 4].handler = NULL;
+        cpu->code_page_gen[addr / SQUIRM_CODE_PAGE_SIZE]++;
+    }
+}
+
+// drops cached decodes for a range of memory.
+// hosts writing to `cpu->mem` directly must call this for the affected range.
+void squirm_cpu_invalidate(squirm_cpu_t* cpu, u16 addr, u16 size) {
+    if (size == 0 || addr > BURROW_MEM_CODE_END) {
+        return;
+    }
+
+    u32 end = (u32)addr + size - 1;
+
+    if (end > BURROW_MEM_CODE_END) {
+        end = BURROW_MEM_CODE_END;
+    }
+
+    for (u32 slot = addr / 4; slot <= end / 4; slot++) {
+        cpu->decoded[slot].handler = NULL;
+    }
+
+    for (u32 page = addr / SQUIRM_CODE_PAGE_SIZE; page <= end / SQUIRM_CODE_PAGE_SIZE; page++) {
+        cpu->code_page_gen[page]++;
+    }
 }
 
 static inline u8 squirm_cpu_read8(squirm_cpu_t* cpu, u16 addr) {
@@ -78,35 +160,508 @@ static inline u16 squirm_cpu_read16(squirm_cpu_t* cpu, u16 addr) {
 
 static inline void squirm_cpu_write8(squirm_cpu_t* cpu, u16 addr, u8 value) {
     cpu->mem[addr] = value;
+    squirm_cpu_invalidate_byte(cpu, addr);
 }
 
 static inline void squirm_cpu_write16(squirm_cpu_t* cpu, u16 addr, u16 value) {
     cpu->mem[addr] = value & 0xFF;
     cpu->mem[addr + 1] = (value >> 8) & 0xFF;
+    squirm_cpu_invalidate_byte(cpu, addr);
+    squirm_cpu_invalidate_byte(cpu, addr + 1);
+}
+
+// keeps rarely taken paths out of the load and store handlers, which `squirm_cpu_run` only
+// inlines while they're small
+#if defined(__GNUC__) || defined(__clang__)
+#define SQUIRM_NOINLINE __attribute__((noinline))
+#else
+#define SQUIRM_NOINLINE
+#endif
+
+// scans the entries for a page only partially covered by them
+SQUIRM_NOINLINE static squirm_mmio_entry_t*
+squirm_cpu_find_mmio_mixed(squirm_cpu_t* cpu, u16 addr) {
+    for (u16 i = 0; i < cpu->mmio_count; i++) {
+        squirm_mmio_entry_t* entry = &cpu->mmio[i];
+        if (entry->start <= addr && addr < entry->end) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+// returns the MMIO entry handling `addr`, or NULL for plain memory
+static inline squirm_mmio_entry_t* squirm_cpu_find_mmio(squirm_cpu_t* cpu, u16 addr) {
+    u8 page = cpu->mmio_page[addr / SQUIRM_MMIO_PAGE_SIZE];
+
+    if (page == SQUIRM_MMIO_PAGE_NONE) {
+        return NULL;
+    }
+
+    if (page != SQUIRM_MMIO_PAGE_MIXED) {
+        return &cpu->mmio[page - 1];
+    }
+
+    return squirm_cpu_find_mmio_mixed(cpu, addr);
+}
+
+SQUIRM_NOINLINE static void
+squirm_cpu_dirty_page(squirm_cpu_t* cpu, squirm_mmio_entry_t* entry, u16 page) {
+    cpu->mmio_dirty[page / 64] |= 1ull << (page % 64);
+
+    if (entry->dirty != NULL) {
+        entry->dirty(entry->user, (u16)(page * SQUIRM_MMIO_PAGE_SIZE));
+    }
+}
+
+// marks the page of `addr` as stored to through the direct-mapped `entry`, telling the host
+// if it was clean
+static inline void squirm_cpu_mark_direct(
+    squirm_cpu_t* cpu,
+    squirm_mmio_entry_t* entry,
+    u16 addr
+) {
+    u16 page = addr / SQUIRM_MMIO_PAGE_SIZE;
+
+    if (!(cpu->mmio_dirty[page / 64] & (1ull << (page % 64)))) {
+        squirm_cpu_dirty_page(cpu, entry, page);
+    }
+}
+
+static inline u8 squirm_cpu_direct_read8(squirm_mmio_entry_t* entry, u32 addr) {
+    return addr < entry->end ? entry->buffer[addr - entry->start] : 0;
+}
+
+static inline void squirm_cpu_direct_write8(
+    squirm_cpu_t* cpu,
+    squirm_mmio_entry_t* entry,
+    u16 addr,
+    u8 value
+) {
+    entry->buffer[addr - entry->start] = value;
+    squirm_cpu_mark_direct(cpu, entry, addr);
+}
+
+// marks the pages from `addr` to `addr + len` clean again, so the next store to one of them
+// calls the `dirty` callback of its entry
+void squirm_cpu_clean(squirm_cpu_t* cpu, u16 addr, u16 len) {
+    if (len == 0) {
+        return;
+    }
+
+    u32 last = ((u32)addr + len - 1) / SQUIRM_MMIO_PAGE_SIZE;
+
+    for (u32 page = addr / SQUIRM_MMIO_PAGE_SIZE; page <= last; page++) {
+        cpu->mmio_dirty[page / 64] &= ~(1ull << (page % 64));
+    }
+}
+
+// writes `len` bytes starting at `addr`, going through MMIO entries where they apply.
+// a run of bytes falling into a single entry is copied to its buffer if it's direct-mapped,
+// or goes to its `write_range` if it has one.
+void squirm_cpu_write_range(squirm_cpu_t* cpu, u16 addr, const u8* data, u16 len) {
+    while (len > 0) {
+        squirm_mmio_entry_t* entry = squirm_cpu_find_mmio(cpu, addr);
+
+        if (entry == NULL) {
+            squirm_cpu_write8(cpu, addr++, *data++);
+            len--;
+            continue;
+        }
+
+        u16 run = len;
+
+        if ((u32)addr + run > entry->end) {
+            run = entry->end - addr;
+        }
+
+        if (entry->buffer != NULL) {
+            memcpy(entry->buffer + (addr - entry->start), data, run);
+
+            u16 last = (u16)((addr + run - 1) / SQUIRM_MMIO_PAGE_SIZE);
+
+            for (u16 page = addr / SQUIRM_MMIO_PAGE_SIZE; page <= last; page++) {
+                u16 page_start = (u16)(page * SQUIRM_MMIO_PAGE_SIZE);
+                squirm_cpu_mark_direct(cpu, entry, page_start > addr ? page_start : addr);
+            }
+        } else if (entry->write_range != NULL) {
+            cpu->mmio_accessed = true;
+            entry->write_range(entry->user, addr, data, run);
+        } else if (entry->write != NULL) {
+            cpu->mmio_accessed = true;
+            for (u16 i = 0; i < run; i++) {
+                entry->write(entry->user, addr + i, data[i]);
+            }
+        }
+
+        addr += run;
+        data += run;
+        len -= run;
+    }
+}
+
+// reads `len` bytes starting at `addr` into `data`, going through MMIO entries where they
+// apply. a run of bytes falling into a single entry is copied from its buffer if it's
+// direct-mapped, or comes from its `read_range` if it has one.
+void squirm_cpu_read_range(squirm_cpu_t* cpu, u16 addr, u8* data, u16 len) {
+    while (len > 0) {
+        squirm_mmio_entry_t* entry = squirm_cpu_find_mmio(cpu, addr);
+
+        if (entry == NULL) {
+            *data++ = squirm_cpu_read8(cpu, addr++);
+            len--;
+            continue;
+        }
+
+        u16 run = len;
+
+        if ((u32)addr + run > entry->end) {
+            run = entry->end - addr;
+        }
+
+        if (entry->buffer != NULL) {
+            memcpy(data, entry->buffer + (addr - entry->start), run);
+            addr += run;
+            data += run;
+            len -= run;
+            continue;
+        }
+
+        cpu->mmio_accessed = true;
+
+        if (entry->read_range != NULL) {
+            entry->read_range(entry->user, addr, data, run);
+        } else if (entry->read != NULL) {
+            for (u16 i = 0; i < run; i++) {
+                data[i] = entry->read(entry->user, addr + i);
+            }
+        } else {
+            memset(data, 0, run);
+        }
+
+        addr += run;
+        data += run;
+        len -= run;
+    }
+}
+
+// computes the arithmetic flags an ALU op sets for operands `a` and `b` and its `result`
+static u16 squirm_cpu_eval_flags(u8 op, u16 a, u16 b, u16 result) {
+    u16 flags = BURROW_FL_NONE;
+
+    if (result == 0) {
+        flags |= BURROW_FL_ZERO;
+    }
+
+    if (result & 0x8000) {
+        flags |= BURROW_FL_SIGN;
+    }
+
+    switch (op) {
+        case BURROW_OP_ADD:
+            if ((u32)a + b > 0xffff) {
+                flags |= BURROW_FL_CARRY;
+            }
+            if (~(a ^ b) & (a ^ result) & 0x8000) {
+                flags |= BURROW_FL_OVERFLOW;
+            }
+            break;
+        case BURROW_OP_SUB:
+            if (a < b) {
+                flags |= BURROW_FL_CARRY;
+            }
+            if ((a ^ b) & (a ^ result) & 0x8000) {
+                flags |= BURROW_FL_OVERFLOW;
+            }
+            break;
+        case BURROW_OP_MUL:
+            if ((u32)a * b > 0xffff) {
+                flags |= BURROW_FL_CARRY | BURROW_FL_OVERFLOW;
+            }
+            break;
+        case BURROW_OP_SHL:
+            // the last bit shifted out
+            if (b >= 1 && b <= 16 && (a >> (16 - b)) & 1) {
+                flags |= BURROW_FL_CARRY;
+            }
+            break;
+        case BURROW_OP_SHR:
+            if (b >= 1 && b <= 16 && (a >> (b - 1)) & 1) {
+                flags |= BURROW_FL_CARRY;
+            }
+            break;
+    }
+
+    return flags;
+}
+
+// kept out of line, since ALU ops read %fl far less often than they write it
+static void squirm_cpu_materialize_flags(squirm_cpu_t* cpu) {
+    u16 mask = BURROW_FL_ZERO | BURROW_FL_CARRY | BURROW_FL_OVERFLOW | BURROW_FL_SIGN;
+    u16 flags =
+        squirm_cpu_eval_flags(cpu->flags_op, cpu->flags_a, cpu->flags_b, cpu->flags_result);
+
+    cpu->reg[BURROW_REG_FL] = (cpu->reg[BURROW_REG_FL] & ~mask) | flags;
+    cpu->flags_op = BURROW_OP_NOP;
+}
+
+// writes the flags of the last ALU op into %fl.
+// hosts must call this before reading %fl from `cpu->reg` directly.
+void squirm_cpu_sync_flags(squirm_cpu_t* cpu) {
+    if (cpu->flags_op == BURROW_OP_NOP) {
+        return;
+    }
+
+    squirm_cpu_materialize_flags(cpu);
+}
+
+// copies page `page` of the base image, which is `base_size` bytes followed by zeros, to `dst`
+static void squirm_cpu_base_page(const u8* base, u32 base_size, u16 page, u8* dst) {
+    u32 start = (u32)page * SQUIRM_SNAPSHOT_PAGE_SIZE;
+    u32 len = 0;
+
+    if (start < base_size) {
+        len = base_size - start;
+        len = len < SQUIRM_SNAPSHOT_PAGE_SIZE ? len : SQUIRM_SNAPSHOT_PAGE_SIZE;
+        memcpy(dst, base + start, len);
+    }
+
+    memset(dst + len, 0, SQUIRM_SNAPSHOT_PAGE_SIZE - len);
+}
+
+// captures the registers and memory of `cpu`. memory is stored as the pages that differ
+// from `base`, the first `base_size` bytes of memory as loaded, usually the ROM, followed by
+// zeros. the result must be freed with `squirm_snapshot_free`.
+squirm_snapshot_t* squirm_cpu_snapshot(squirm_cpu_t* cpu, const u8* base, u32 base_size) {
+    u64 pages[SQUIRM_SNAPSHOT_PAGE_COUNT / 64] = { 0 };
+    u16 page_count = 0;
+    u8 page_base[SQUIRM_SNAPSHOT_PAGE_SIZE];
+
+    for (u16 page = 0; page < SQUIRM_SNAPSHOT_PAGE_COUNT; page++) {
+        squirm_cpu_base_page(base, base_size, page, page_base);
+
+        if (memcmp(cpu->mem + page * SQUIRM_SNAPSHOT_PAGE_SIZE, page_base, sizeof(page_base))) {
+            pages[page / 64] |= 1ull << (page % 64);
+            page_count++;
+        }
+    }
+
+    squirm_snapshot_t* snapshot =
+        malloc(sizeof(squirm_snapshot_t) + (usize)page_count * SQUIRM_SNAPSHOT_PAGE_SIZE);
+
+    if (snapshot == NULL) {
+        LOG_ERROR("Failed to allocate memory for snapshot\n");
+        exit(1);
+    }
+
+    squirm_cpu_sync_flags(cpu);
+    memcpy(snapshot->reg, cpu->reg, sizeof(snapshot->reg));
+    snapshot->executed_op_count = cpu->executed_op_count;
+    memcpy(snapshot->pages, pages, sizeof(pages));
+    snapshot->page_count = page_count;
+
+    u8* data = snapshot->data;
+
+    for (u16 page = 0; page < SQUIRM_SNAPSHOT_PAGE_COUNT; page++) {
+        if (pages[page / 64] & (1ull << (page % 64))) {
+            u16 addr = (u16)(page * SQUIRM_SNAPSHOT_PAGE_SIZE);
+            memcpy(data, cpu->mem + addr, SQUIRM_SNAPSHOT_PAGE_SIZE);
+            data += SQUIRM_SNAPSHOT_PAGE_SIZE;
+        }
+    }
+
+    return snapshot;
+}
+
+// puts `cpu` back into the state of `snapshot`, taken against the same base image. only
+// pages whose contents change are written, so decoded code elsewhere stays cached.
+void squirm_cpu_restore(
+    squirm_cpu_t* cpu,
+    const squirm_snapshot_t* snapshot,
+    const u8* base,
+    u32 base_size
+) {
+    const u8* data = snapshot->data;
+    u8 page_base[SQUIRM_SNAPSHOT_PAGE_SIZE];
+
+    for (u16 page = 0; page < SQUIRM_SNAPSHOT_PAGE_COUNT; page++) {
+        const u8* src = page_base;
+
+        if (snapshot->pages[page / 64] & (1ull << (page % 64))) {
+            src = data;
+            data += SQUIRM_SNAPSHOT_PAGE_SIZE;
+        } else {
+            squirm_cpu_base_page(base, base_size, page, page_base);
+        }
+
+        u16 addr = (u16)(page * SQUIRM_SNAPSHOT_PAGE_SIZE);
+
+        if (memcmp(cpu->mem + addr, src, SQUIRM_SNAPSHOT_PAGE_SIZE) != 0) {
+            memcpy(cpu->mem + addr, src, SQUIRM_SNAPSHOT_PAGE_SIZE);
+            squirm_cpu_invalidate(cpu, addr, SQUIRM_SNAPSHOT_PAGE_SIZE);
+        }
+    }
+
+    memcpy(cpu->reg, snapshot->reg, sizeof(cpu->reg));
+    cpu->flags_op = BURROW_OP_NOP;
+    cpu->executed_op_count = (usize)snapshot->executed_op_count;
+    cpu->mmio_accessed = false;
+    cpu->fault = SQUIRM_CPU_FAULT_NONE;
+}
+
+void squirm_snapshot_free(squirm_snapshot_t* snapshot) {
+    free(snapshot);
 }
 
 static inline u16 squirm_cpu_read_reg(squirm_cpu_t* cpu, u8 reg) {
+    if (reg == BURROW_REG_FL && cpu->flags_op != BURROW_OP_NOP) {
+        squirm_cpu_materialize_flags(cpu);
+    }
+
     return cpu->reg[reg];
 }
 
 static inline void squirm_cpu_write_reg(squirm_cpu_t* cpu, u8 reg, u16 value) {
+    if (reg == BURROW_REG_FL) {
+        // overrides whatever the last ALU op set
+        cpu->flags_op = BURROW_OP_NOP;
+    }
+
     cpu->reg[reg] = value;
 }
 
-static inline u16 squirm_cpu_flags(squirm_cpu_t* cpu) {
-    return cpu->reg[BURROW_REG_FL];
+// ALU ops read and write registers directly, unless one of them is %fl
+static inline void squirm_cpu_alu_begin(squirm_cpu_t* cpu, squirm_op_t op) {
+    if (op.args.src_a == BURROW_REG_FL || op.args.src_b == BURROW_REG_FL) {
+        squirm_cpu_sync_flags(cpu);
+    }
 }
 
-static inline void squirm_cpu_set_flags(squirm_cpu_t* cpu, u16 flags) {
-    cpu->reg[BURROW_REG_FL] = flags;
+// writes the result of an ALU op and records it for the flags to be computed from later
+static inline void
+squirm_cpu_alu_end(squirm_cpu_t* cpu, squirm_op_t op, u16 a, u16 b, u16 result) {
+    cpu->reg[op.args.dest] = result;
+
+    if (op.args.dest == BURROW_REG_FL) {
+        // the result overrides whatever flags the op would have set
+        cpu->flags_op = BURROW_OP_NOP;
+        return;
+    }
+
+    cpu->flags_op = op.op;
+    cpu->flags_a = a;
+    cpu->flags_b = b;
+    cpu->flags_result = result;
 }
 
+// only for flags that are never computed lazily, like FIN
 static inline void squirm_cpu_set_flag(squirm_cpu_t* cpu, u16 flag) {
-    squirm_cpu_set_flags(cpu, squirm_cpu_flags(cpu) | flag);
+    cpu->reg[BURROW_REG_FL] |= flag;
 }
 
-static inline u16 squirm_op_imm(squirm_op_t op) {
-    return (op.args.src_a << 8) | (op.args.src_b & 0xFF);
+// stops the CPU on an error in the program, the host finds out through `cpu->fault`
+static inline void squirm_cpu_fault(squirm_cpu_t* cpu, squirm_cpu_fault_t fault) {
+    cpu->fault = fault;
+    squirm_cpu_set_flag(cpu, BURROW_FL_FIN);
+}
+
+static inline bool squirm_cpu_zero(squirm_cpu_t* cpu) {
+    if (cpu->flags_op != BURROW_OP_NOP) {
+        return cpu->flags_result == 0;
+    }
+
+    return cpu->reg[BURROW_REG_FL] & BURROW_FL_ZERO;
+}
+
+// loads and stores hitting an MMIO entry, direct-mapped or not
+
+SQUIRM_NOINLINE static void squirm_cpu_mmio_load8(
+    squirm_cpu_t* cpu,
+    squirm_mmio_entry_t* entry,
+    u16 addr,
+    u8 dest
+) {
+    if (entry->buffer != NULL) {
+        squirm_cpu_write_reg(cpu, dest, squirm_cpu_direct_read8(entry, addr));
+        return;
+    }
+    cpu->mmio_accessed = true;
+    if (entry->read == NULL) {
+        return;
+    }
+    u8 value = entry->read(entry->user, addr);
+    squirm_cpu_write_reg(cpu, dest, value);
+}
+
+SQUIRM_NOINLINE static void squirm_cpu_mmio_load16(
+    squirm_cpu_t* cpu,
+    squirm_mmio_entry_t* entry,
+    u16 addr,
+    u8 dest
+) {
+    if (entry->buffer != NULL) {
+        u8 value_lo = squirm_cpu_direct_read8(entry, addr);
+        u8 value_hi = squirm_cpu_direct_read8(entry, (u32)addr + 1);
+        squirm_cpu_write_reg(cpu, dest, (u16)(value_lo | (value_hi << 8)));
+        return;
+    }
+    cpu->mmio_accessed = true;
+    if (entry->read16 != NULL) {
+        squirm_cpu_write_reg(cpu, dest, entry->read16(entry->user, addr));
+        return;
+    }
+    if (entry->read == NULL) {
+        return;
+    }
+    u8 value_hi = entry->read(entry->user, addr);
+    u8 value_lo = entry->read(entry->user, addr + 1);
+    u16 value = value_hi | (value_lo << 8);
+    squirm_cpu_write_reg(cpu, dest, value);
+}
+
+SQUIRM_NOINLINE static void squirm_cpu_mmio_store8(
+    squirm_cpu_t* cpu,
+    squirm_mmio_entry_t* entry,
+    u16 addr,
+    u8 value
+) {
+    if (entry->buffer != NULL) {
+        squirm_cpu_direct_write8(cpu, entry, addr, value);
+        return;
+    }
+    cpu->mmio_accessed = true;
+    if (entry->write == NULL) {
+        return;
+    }
+    entry->write(entry->user, addr, value);
+}
+
+SQUIRM_NOINLINE static void squirm_cpu_mmio_store16(
+    squirm_cpu_t* cpu,
+    squirm_mmio_entry_t* entry,
+    u16 addr,
+    u16 value
+) {
+    if (entry->buffer != NULL) {
+        squirm_cpu_direct_write8(cpu, entry, addr, (u8)(value >> 8));
+        if ((u32)addr + 1 < entry->end) {
+            squirm_cpu_direct_write8(cpu, entry, (u16)(addr + 1), (u8)value);
+        }
+        return;
+    }
+    cpu->mmio_accessed = true;
+    if (entry->write16 != NULL) {
+        entry->write16(entry->user, addr, value);
+        return;
+    }
+    if (entry->write == NULL) {
+        return;
+    }
+    u8 value_hi = (value >> 8) & 0xff;
+    u8 value_lo = value & 0xff;
+    entry->write(entry->user, addr, value_hi);
+    entry->write(entry->user, addr + 1, value_lo);
 }
 
 OP_HANDLER(nop) {
@@ -117,26 +672,19 @@ OP_HANDLER(nop) {
 
 OP_HANDLER(ldi) {
     u8 reg = op.args.dest;
-    u16 value = squirm_op_imm(op);
+    u16 value = op.imm;
     squirm_cpu_write_reg(cpu, reg, value);
 }
 
 OP_HANDLER(ldr) {
     u8 dest = op.args.dest;
-    u16 addr = squirm_op_imm(op);
+    u16 addr = op.imm;
 
-    for (int i = 0; i < cpu->mmio_count; i++) {
-        squirm_mmio_entry_t entry = cpu->mmio[i];
-        if (entry.start <= addr && addr < entry.end) {
-            if (entry.read == NULL) {
-                return;
-            }
-            u8 value_hi = entry.read(addr);
-            u8 value_lo = entry.read(addr + 1);
-            u16 value = value_hi | (value_lo << 8);
-            squirm_cpu_write_reg(cpu, dest, value);
-            return;
-        }
+    squirm_mmio_entry_t* entry = squirm_cpu_find_mmio(cpu, addr);
+
+    if (entry != NULL) {
+        squirm_cpu_mmio_load16(cpu, entry, addr, dest);
+        return;
     }
 
     u16 value = squirm_cpu_read16(cpu, addr);
@@ -145,196 +693,134 @@ OP_HANDLER(ldr) {
 
 OP_HANDLER(ldrb) {
     u8 dest = op.args.dest;
-    u16 addr = squirm_op_imm(op);
-    for (int i = 0; i < cpu->mmio_count; i++) {
-        squirm_mmio_entry_t entry = cpu->mmio[i];
-        if (entry.start <= addr && addr < entry.end) {
-            if (entry.read == NULL) {
-                return;
-            }
-            u8 value = entry.read(addr);
-            squirm_cpu_write_reg(cpu, dest, value);
-            return;
-        }
+    u16 addr = op.imm;
+    squirm_mmio_entry_t* entry = squirm_cpu_find_mmio(cpu, addr);
+
+    if (entry != NULL) {
+        squirm_cpu_mmio_load8(cpu, entry, addr, dest);
+        return;
     }
     u8 value = squirm_cpu_read8(cpu, addr);
     squirm_cpu_write_reg(cpu, dest, value);
 }
 
 OP_HANDLER(add) {
-    u8 dest = op.args.dest;
-    u8 a = op.args.src_a;
-    u8 b = op.args.src_b;
-    u16 result = squirm_cpu_read_reg(cpu, a) + squirm_cpu_read_reg(cpu, b);
+    squirm_cpu_alu_begin(cpu, op);
+    u16 a_value = cpu->reg[op.args.src_a];
+    u16 b_value = cpu->reg[op.args.src_b];
+    u16 result = (u16)(a_value + b_value);
 
-    if (result == 0) {
-        squirm_cpu_set_flag(cpu, BURROW_FL_ZERO);
-    } else {
-        squirm_cpu_set_flags(cpu, squirm_cpu_flags(cpu) & ~BURROW_FL_ZERO);
-    }
-    squirm_cpu_write_reg(cpu, dest, result);
+    squirm_cpu_alu_end(cpu, op, a_value, b_value, result);
 }
 
 OP_HANDLER(sub) {
-    u8 dest = op.args.dest;
-    u8 a = op.args.src_a;
-    u8 b = op.args.src_b;
-    u16 result = squirm_cpu_read_reg(cpu, a) - squirm_cpu_read_reg(cpu, b);
+    squirm_cpu_alu_begin(cpu, op);
+    u16 a_value = cpu->reg[op.args.src_a];
+    u16 b_value = cpu->reg[op.args.src_b];
+    u16 result = (u16)(a_value - b_value);
 
-    if (result == 0) {
-        squirm_cpu_set_flag(cpu, BURROW_FL_ZERO);
-    } else {
-        squirm_cpu_set_flags(cpu, squirm_cpu_flags(cpu) & ~BURROW_FL_ZERO);
-    }
-    squirm_cpu_write_reg(cpu, dest, result);
+    squirm_cpu_alu_end(cpu, op, a_value, b_value, result);
 }
 
 OP_HANDLER(mul) {
-    u8 dest = op.args.dest;
-    u8 a = op.args.src_a;
-    u8 b = op.args.src_b;
-    u16 result = squirm_cpu_read_reg(cpu, a) * squirm_cpu_read_reg(cpu, b);
-
-    if (result == 0) {
-        squirm_cpu_set_flag(cpu, BURROW_FL_ZERO);
-    } else {
-        squirm_cpu_set_flags(cpu, squirm_cpu_flags(cpu) & ~BURROW_FL_ZERO);
-    }
+    squirm_cpu_alu_begin(cpu, op);
+    u16 a_value = cpu->reg[op.args.src_a];
+    u16 b_value = cpu->reg[op.args.src_b];
+    u16 result = (u16)((u32)a_value * b_value);
 
-    squirm_cpu_write_reg(cpu, dest, result);
+    squirm_cpu_alu_end(cpu, op, a_value, b_value, result);
 }
 
 OP_HANDLER(div) {
-    u8 dest = op.args.dest;
-    u8 a = op.args.src_a;
-    u8 b = op.args.src_b;
-
-    u16 b_value = squirm_cpu_read_reg(cpu, b);
+    squirm_cpu_alu_begin(cpu, op);
+    u16 a_value = cpu->reg[op.args.src_a];
+    u16 b_value = cpu->reg[op.args.src_b];
 
     if (b_value == 0) {
         LOG_ERROR("division by zero at %04x\n", cpu->reg[BURROW_REG_IP] - 4);
-        exit(1);
+        squirm_cpu_fault(cpu, SQUIRM_CPU_FAULT_DIV_ZERO);
+        return;
     }
 
-    u16 result = squirm_cpu_read_reg(cpu, a) / b_value;
+    u16 result = a_value / b_value;
 
-    if (result == 0) {
-        squirm_cpu_set_flag(cpu, BURROW_FL_ZERO);
-    } else {
-        squirm_cpu_set_flags(cpu, squirm_cpu_flags(cpu) & ~BURROW_FL_ZERO);
-    }
-
-    squirm_cpu_write_reg(cpu, dest, result);
+    squirm_cpu_alu_end(cpu, op, a_value, b_value, result);
 }
 
 OP_HANDLER(mod) {
-    u8 dest = op.args.dest;
-    u8 a = op.args.src_a;
-    u8 b = op.args.src_b;
-    u16 b_value = squirm_cpu_read_reg(cpu, b);
+    squirm_cpu_alu_begin(cpu, op);
+    u16 a_value = cpu->reg[op.args.src_a];
+    u16 b_value = cpu->reg[op.args.src_b];
 
     if (b_value == 0) {
         LOG_ERROR("division by zero at %04x\n", cpu->reg[BURROW_REG_IP] - 4);
-        exit(1);
+        squirm_cpu_fault(cpu, SQUIRM_CPU_FAULT_DIV_ZERO);
+        return;
     }
 
-    u16 result = squirm_cpu_read_reg(cpu, a) % b_value;
+    u16 result = a_value % b_value;
 
-    if (result == 0) {
-        squirm_cpu_set_flag(cpu, BURROW_FL_ZERO);
-    } else {
-        squirm_cpu_set_flags(cpu, squirm_cpu_flags(cpu) & ~BURROW_FL_ZERO);
-    }
-
-    squirm_cpu_write_reg(cpu, dest, result);
+    squirm_cpu_alu_end(cpu, op, a_value, b_value, result);
 }
 
 OP_HANDLER(and) {
-    u8 dest = op.args.dest;
-    u8 a = op.args.src_a;
-    u8 b = op.args.src_b;
-    u16 result = squirm_cpu_read_reg(cpu, a) & squirm_cpu_read_reg(cpu, b);
+    squirm_cpu_alu_begin(cpu, op);
+    u16 a_value = cpu->reg[op.args.src_a];
+    u16 b_value = cpu->reg[op.args.src_b];
+    u16 result = (u16)(a_value & b_value);
 
-    if (result == 0) {
-        squirm_cpu_set_flag(cpu, BURROW_FL_ZERO);
-    } else {
-        squirm_cpu_set_flags(cpu, squirm_cpu_flags(cpu) & ~BURROW_FL_ZERO);
-    }
-
-    squirm_cpu_write_reg(cpu, dest, result);
+    squirm_cpu_alu_end(cpu, op, a_value, b_value, result);
 }
 
 OP_HANDLER(or) {
-    u8 dest = op.args.dest;
-    u8 a = op.args.src_a;
-    u8 b = op.args.src_b;
-    u16 result = squirm_cpu_read_reg(cpu, a) | squirm_cpu_read_reg(cpu, b);
-
-    if (result == 0) {
-        squirm_cpu_set_flag(cpu, BURROW_FL_ZERO);
-    } else {
-        squirm_cpu_set_flags(cpu, squirm_cpu_flags(cpu) & ~BURROW_FL_ZERO);
-    }
+    squirm_cpu_alu_begin(cpu, op);
+    u16 a_value = cpu->reg[op.args.src_a];
+    u16 b_value = cpu->reg[op.args.src_b];
+    u16 result = (u16)(a_value | b_value);
 
-    squirm_cpu_write_reg(cpu, dest, result);
+    squirm_cpu_alu_end(cpu, op, a_value, b_value, result);
 }
 
 OP_HANDLER(xor) {
-    u8 dest = op.args.dest;
-    u8 a = op.args.src_a;
-    u8 b = op.args.src_b;
-    u16 result = squirm_cpu_read_reg(cpu, a) ^ squirm_cpu_read_reg(cpu, b);
-
-    if (result == 0) {
-        squirm_cpu_set_flag(cpu, BURROW_FL_ZERO);
-    } else {
-        squirm_cpu_set_flags(cpu, squirm_cpu_flags(cpu) & ~BURROW_FL_ZERO);
-    }
+    squirm_cpu_alu_begin(cpu, op);
+    u16 a_value = cpu->reg[op.args.src_a];
+    u16 b_value = cpu->reg[op.args.src_b];
+    u16 result = (u16)(a_value ^ b_value);
 
-    squirm_cpu_write_reg(cpu, dest, result);
+    squirm_cpu_alu_end(cpu, op, a_value, b_value, result);
 }
 
+// shift counts of 16 and above shift every bit out
 OP_HANDLER(shl) {
-    u8 dest = op.args.dest;
-    u8 a = op.args.src_a;
-    u16 b = squirm_cpu_read_reg(cpu, op.args.src_b);
-    u16 result = squirm_cpu_read_reg(cpu, a) << b;
-
-    if (result == 0) {
-        squirm_cpu_set_flag(cpu, BURROW_FL_ZERO);
-    } else {
-        squirm_cpu_set_flags(cpu, squirm_cpu_flags(cpu) & ~BURROW_FL_ZERO);
-    }
+    squirm_cpu_alu_begin(cpu, op);
+    u16 a_value = cpu->reg[op.args.src_a];
+    u16 b_value = cpu->reg[op.args.src_b];
+    u16 result = b_value < 16 ? (u16)(a_value << b_value) : 0;
 
-    squirm_cpu_write_reg(cpu, dest, result);
+    squirm_cpu_alu_end(cpu, op, a_value, b_value, result);
 }
 
 OP_HANDLER(shr) {
-    u8 dest = op.args.dest;
-    u8 a = op.args.src_a;
-    u16 b = squirm_cpu_read_reg(cpu, op.args.src_b);
-    u16 result = squirm_cpu_read_reg(cpu, a) >> b;
+    squirm_cpu_alu_begin(cpu, op);
+    u16 a_value = cpu->reg[op.args.src_a];
+    u16 b_value = cpu->reg[op.args.src_b];
+    u16 result = b_value < 16 ? a_value >> b_value : 0;
 
-    if (result == 0) {
-        squirm_cpu_set_flag(cpu, BURROW_FL_ZERO);
-    } else {
-        squirm_cpu_set_flags(cpu, squirm_cpu_flags(cpu) & ~BURROW_FL_ZERO);
-    }
-
-    squirm_cpu_write_reg(cpu, dest, result);
+    squirm_cpu_alu_end(cpu, op, a_value, b_value, result);
 }
 
 OP_HANDLER(jmp) {
-    u16 addr = squirm_op_imm(op);
+    u16 addr = op.imm;
 
     cpu->reg[BURROW_REG_IP] = addr;
 }
 
 OP_HANDLER(jz) {
-    u16 addr = squirm_op_imm(op);
-    if (squirm_cpu_flags(cpu) & BURROW_FL_ZERO) {
+    u16 addr = op.imm;
+    if (squirm_cpu_zero(cpu)) {
         cpu->reg[BURROW_REG_IP] = addr;
-        squirm_cpu_set_flags(cpu, squirm_cpu_flags(cpu) & ~BURROW_FL_ZERO);
+        squirm_cpu_sync_flags(cpu);
+        cpu->reg[BURROW_REG_FL] &= ~BURROW_FL_ZERO;
     }
 }
 
@@ -344,39 +830,28 @@ OP_HANDLER(jd) {
 }
 
 OP_HANDLER(sti) {
-    u16 addr = squirm_op_imm(op);
+    u16 addr = op.imm;
     u16 value = squirm_cpu_read_reg(cpu, op.args.dest);
 
-    for (u16 i = 0; i < cpu->mmio_count; i++) {
-        squirm_mmio_entry_t entry = cpu->mmio[i];
-        if (entry.start <= addr && addr < entry.end) {
-            if (entry.write == NULL) {
-                return;
-            }
-            u8 value_hi = (value >> 8) & 0xff;
-            u8 value_lo = value & 0xff;
-            entry.write(addr, value_hi);
-            entry.write(addr + 1, value_lo);
-            return;
-        }
+    squirm_mmio_entry_t* entry = squirm_cpu_find_mmio(cpu, addr);
+
+    if (entry != NULL) {
+        squirm_cpu_mmio_store16(cpu, entry, addr, value);
+        return;
     }
 
     squirm_cpu_write16(cpu, addr, value);
 }
 
 OP_HANDLER(stib) {
-    u16 addr = squirm_op_imm(op);
+    u16 addr = op.imm;
     u8 value = squirm_cpu_read_reg(cpu, op.args.dest);
 
-    for (u16 i = 0; i < cpu->mmio_count; i++) {
-        squirm_mmio_entry_t entry = cpu->mmio[i];
-        if (entry.start <= addr && addr < entry.end) {
-            if (entry.write == NULL) {
-                return;
-            }
-            cpu->mmio[i].write(addr, value);
-            return;
-        }
+    squirm_mmio_entry_t* entry = squirm_cpu_find_mmio(cpu, addr);
+
+    if (entry != NULL) {
+        squirm_cpu_mmio_store8(cpu, entry, addr, value);
+        return;
     }
 
     squirm_cpu_write8(cpu, addr, value);
@@ -386,18 +861,11 @@ OP_HANDLER(str) {
     u16 addr = squirm_cpu_read_reg(cpu, op.args.dest);
     u16 value = squirm_cpu_read_reg(cpu, op.args.src_a);
 
-    for (u16 i = 0; i < cpu->mmio_count; i++) {
-        squirm_mmio_entry_t entry = cpu->mmio[i];
-        if (entry.start <= addr && addr < entry.end) {
-            if (entry.write == NULL) {
-                return;
-            }
-            u8 value_hi = (value >> 8) & 0xff;
-            u8 value_lo = value & 0xff;
-            entry.write(addr, value_hi);
-            entry.write(addr + 1, value_lo);
-            return;
-        }
+    squirm_mmio_entry_t* entry = squirm_cpu_find_mmio(cpu, addr);
+
+    if (entry != NULL) {
+        squirm_cpu_mmio_store16(cpu, entry, addr, value);
+        return;
     }
 
     squirm_cpu_write16(cpu, addr, value);
@@ -407,15 +875,11 @@ OP_HANDLER(strb) {
     u16 addr = squirm_cpu_read_reg(cpu, op.args.dest);
     u8 value = squirm_cpu_read_reg(cpu, op.args.src_a);
 
-    for (u16 i = 0; i < cpu->mmio_count; i++) {
-        squirm_mmio_entry_t entry = cpu->mmio[i];
-        if (entry.start <= addr && addr < entry.end) {
-            if (entry.write == NULL) {
-                return;
-            }
-            entry.write(addr, value);
-            return;
-        }
+    squirm_mmio_entry_t* entry = squirm_cpu_find_mmio(cpu, addr);
+
+    if (entry != NULL) {
+        squirm_cpu_mmio_store8(cpu, entry, addr, value);
+        return;
     }
 
     squirm_cpu_write8(cpu, addr, value);
@@ -427,7 +891,8 @@ OP_HANDLER(sys) {
 
     if (syscall >= cpu->syscall_count) {
         LOG_ERROR("invalid syscall %d\n", syscall);
-        exit(1);
+        squirm_cpu_fault(cpu, SQUIRM_CPU_FAULT_INVALID_SYSCALL);
+        return;
     }
 
     cpu->syscalls[syscall](cpu);
@@ -462,33 +927,576 @@ static const squirm_cpu_op_fn k_op_handlers[BURROW_OP_COUNT] = {
 
 // clang-format on
 
+static squirm_op_t squirm_cpu_decode_at(squirm_cpu_t* cpu, u16 ip) {
+    u8 op = cpu->mem[ip++];
+    u8 dest = cpu->mem[ip++];
+    u8 src_a = cpu->mem[ip++];
+    u8 src_b = cpu->mem[ip++];
+
+    return squirm_op_new(op, dest, src_a, src_b);
+}
+
 squirm_op_t squirm_cpu_decode_op(squirm_cpu_t* cpu) {
-    squirm_op_t op;
-    u16 ip = cpu->reg[BURROW_REG_IP];
+    return squirm_cpu_decode_at(cpu, cpu->reg[BURROW_REG_IP]);
+}
 
-    op.op = cpu->mem[ip++];
-    op.args.dest = cpu->mem[ip++];
-    op.args.src_a = cpu->mem[ip++];
-    op.args.src_b = cpu->mem[ip++];
+// decodes the instruction at `ip` into its cache slot.
+// returns NULL if the opcode is invalid, in which case nothing is cached.
+static squirm_decoded_op_t* squirm_cpu_decode_slot(squirm_cpu_t* cpu, u16 ip) {
+    squirm_op_t op = squirm_cpu_decode_at(cpu, ip);
 
-    return op;
+    if (op.op >= BURROW_OP_COUNT) {
+        return NULL;
+    }
+
+    squirm_decoded_op_t* slot = &cpu->decoded[ip / 4];
+    slot->op = op;
+    slot->handler = k_op_handlers[op.op];
+    slot->dispatch = op.op;
+
+    return slot;
 }
 
-void squirm_cpu_step(squirm_cpu_t* cpu) {
-    if (cpu->reg[BURROW_REG_IP] % 4 != 0) {
-        LOG_ERROR("unaligned instruction pointer %04x\n", cpu->reg[BURROW_REG_IP]);
-        squirm_cpu_set_flag(cpu, BURROW_FL_FIN);
-        return;
+// fetches the instruction at %ip, going through the decode cache where possible.
+// returns NULL and faults the CPU if there is no valid instruction at %ip.
+static inline squirm_cpu_op_fn squirm_cpu_fetch(squirm_cpu_t* cpu, squirm_op_t* op) {
+    u16 ip = cpu->reg[BURROW_REG_IP];
+
+    if (ip % 4 != 0) {
+        LOG_ERROR("unaligned instruction pointer %04x\n", ip);
+        squirm_cpu_fault(cpu, SQUIRM_CPU_FAULT_UNALIGNED_IP);
+        return NULL;
     }
 
-    squirm_op_t op = squirm_cpu_decode_op(cpu);
+    if (ip <= BURROW_MEM_CODE_END) {
+        squirm_decoded_op_t* slot = &cpu->decoded[ip / 4];
 
-    if (op.op >= BURROW_OP_COUNT) {
-        LOG_ERROR("invalid opcode %02x at %04x\n", op.op, cpu->reg[BURROW_REG_IP]);
-        squirm_cpu_set_flag(cpu, BURROW_FL_FIN);
+        if (slot->handler == NULL) {
+            slot = squirm_cpu_decode_slot(cpu, ip);
+
+            if (slot == NULL) {
+                LOG_ERROR("invalid opcode %02x at %04x\n", cpu->mem[ip], ip);
+                squirm_cpu_fault(cpu, SQUIRM_CPU_FAULT_INVALID_OP);
+                return NULL;
+            }
+        }
+
+        *op = slot->op;
+        return slot->handler;
+    }
+
+    *op = squirm_cpu_decode_op(cpu);
+
+    if (op->op >= BURROW_OP_COUNT) {
+        LOG_ERROR("invalid opcode %02x at %04x\n", op->op, ip);
+        squirm_cpu_fault(cpu, SQUIRM_CPU_FAULT_INVALID_OP);
+        return NULL;
+    }
+
+    return k_op_handlers[op->op];
+}
+
+// executes an already decoded op. %ip must already point past it.
+void squirm_cpu_exec(squirm_cpu_t* cpu, squirm_op_t op) {
+    k_op_handlers[op.op](cpu, op);
+}
+
+void squirm_cpu_step(squirm_cpu_t* cpu) {
+    squirm_op_t op;
+    squirm_cpu_op_fn handler = squirm_cpu_fetch(cpu, &op);
+
+    if (handler == NULL) {
         return;
     }
+
     cpu->reg[BURROW_REG_IP] += 4;
     cpu->executed_op_count++;
-    k_op_handlers[op.op](cpu, op);
+    handler(cpu, op);
+}
+
+// whether writing `reg` changes control flow, so the run loop has to look at it first
+static inline bool squirm_cpu_writes_control(u8 reg) {
+    return reg == BURROW_REG_IP || reg == BURROW_REG_FL;
+}
+
+// returns the superinstruction covering `first` followed by `second`, or the opcode of
+// `first` if the pair isn't fused
+u8 squirm_cpu_fuse(squirm_op_t first, squirm_op_t second) {
+    switch (first.op) {
+        case BURROW_OP_LDI:
+            if (!squirm_cpu_writes_control(first.args.dest) && second.op >= BURROW_OP_ADD &&
+                second.op <= BURROW_OP_SHR && second.args.dest != BURROW_REG_FL) {
+                return SQUIRM_FUSED_LDI_ADD + (second.op - BURROW_OP_ADD);
+            }
+            break;
+        case BURROW_OP_SUB:
+            if (!squirm_cpu_writes_control(first.args.dest) && second.op == BURROW_OP_JZ) {
+                return SQUIRM_FUSED_SUB_JZ;
+            }
+            break;
+        case BURROW_OP_JZ:
+            if (second.op == BURROW_OP_JMP) {
+                return SQUIRM_FUSED_JZ_JMP;
+            }
+            break;
+    }
+
+    return first.op;
+}
+
+// whether `op` has to be the last one of its block. writing %fl may set FIN, which is only
+// checked between blocks.
+static inline bool squirm_cpu_ends_block(squirm_op_t op) {
+    switch (op.op) {
+        case BURROW_OP_JMP:
+        case BURROW_OP_JZ:
+        case BURROW_OP_JD:
+        case BURROW_OP_SYS:
+            return true;
+        case BURROW_OP_LDI:
+        case BURROW_OP_LDR:
+        case BURROW_OP_LDRB:
+        case BURROW_OP_ADD:
+        case BURROW_OP_SUB:
+        case BURROW_OP_MUL:
+        case BURROW_OP_DIV:
+        case BURROW_OP_MOD:
+        case BURROW_OP_AND:
+        case BURROW_OP_OR:
+        case BURROW_OP_XOR:
+        case BURROW_OP_SHL:
+        case BURROW_OP_SHR:
+            return squirm_cpu_writes_control(op.args.dest);
+        default:
+            return false;
+    }
+}
+
+static inline bool squirm_cpu_block_fresh(squirm_cpu_t* cpu, squirm_block_t* block) {
+    u16 page = block->start / SQUIRM_CODE_PAGE_SIZE;
+    return block->len != 0 && block->gen == cpu->code_page_gen[page];
+}
+
+// returns the block starting at `ip`, building it if it is missing or stale.
+// returns NULL if `ip` is outside of the code region or not at a valid instruction.
+static squirm_block_t* squirm_cpu_block_at(squirm_cpu_t* cpu, u16 ip) {
+    if (ip % 4 != 0 || ip > BURROW_MEM_CODE_END) {
+        return NULL;
+    }
+
+    squirm_block_t* block = &cpu->blocks[ip / 4];
+
+    if (squirm_cpu_block_fresh(cpu, block)) {
+        return block;
+    }
+
+    u16 page = ip / SQUIRM_CODE_PAGE_SIZE;
+
+    block->start = ip;
+    block->len = 0;
+    block->gen = cpu->code_page_gen[page];
+    block->next = NULL;
+    block->taken = NULL;
+
+    squirm_decoded_op_t* ops = &cpu->decoded[ip / 4];
+
+    // blocks never cross a code page, so a single generation covers all of their ops
+    for (u16 addr = ip; addr / SQUIRM_CODE_PAGE_SIZE == page; addr += 4) {
+        squirm_decoded_op_t* slot = &cpu->decoded[addr / 4];
+
+        if (slot->handler == NULL) {
+            slot = squirm_cpu_decode_slot(cpu, addr);
+
+            if (slot == NULL) {
+                break;
+            }
+        }
+
+        // a `jz` followed by a `jmp` stays in the block, so the two can be fused
+        bool after_jz = block->len > 0 && ops[block->len - 1].op.op == BURROW_OP_JZ;
+
+        if (after_jz && slot->op.op != BURROW_OP_JMP) {
+            break;
+        }
+
+        block->len++;
+
+        if (after_jz || (squirm_cpu_ends_block(slot->op) && slot->op.op != BURROW_OP_JZ)) {
+            break;
+        }
+    }
+
+    for (u16 i = 0; i < block->len; i++) {
+        if (i + 1 < block->len) {
+            ops[i].dispatch = squirm_cpu_fuse(ops[i].op, ops[i + 1].op);
+        } else {
+            ops[i].dispatch = ops[i].op.op;
+        }
+    }
+
+    return block->len != 0 ? block : NULL;
+}
+
+// finds the ops to run at %ip once the current block is exhausted. follows the chain from
+// `*block` where possible, and falls back to fetching a single op into `single` if no block
+// can be built at %ip. returns NULL and faults the CPU if there is no valid instruction.
+static inline squirm_decoded_op_t* squirm_cpu_next_block(
+    squirm_cpu_t* cpu,
+    squirm_block_t** block,
+    squirm_decoded_op_t** end,
+    squirm_decoded_op_t* single
+) {
+    u16 ip = cpu->reg[BURROW_REG_IP];
+    squirm_block_t* prev = *block;
+    squirm_block_t* next;
+
+    if (prev != NULL) {
+        squirm_block_t** link = ip == prev->start + prev->len * 4 ? &prev->next : &prev->taken;
+        next = *link;
+
+        if (next == NULL || next->start != ip || !squirm_cpu_block_fresh(cpu, next)) {
+            next = squirm_cpu_block_at(cpu, ip);
+            *link = next;
+        }
+    } else {
+        next = squirm_cpu_block_at(cpu, ip);
+    }
+
+    *block = next;
+
+    if (next == NULL) {
+        single->handler = squirm_cpu_fetch(cpu, &single->op);
+
+        if (single->handler == NULL) {
+            return NULL;
+        }
+
+        single->dispatch = single->op.op;
+
+        *end = single + 1;
+        return single;
+    }
+
+    squirm_decoded_op_t* ops = &cpu->decoded[ip / 4];
+    *end = ops + next->len;
+    return ops;
 }
+
+// the run loop dispatches with computed gotos where the compiler supports them,
+// and falls back to a plain switch otherwise (or when SQUIRM_SWITCH_DISPATCH is defined).
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(SQUIRM_SWITCH_DISPATCH)
+#define SQUIRM_THREADED_DISPATCH
+#endif
+
+// ops are taken from the current block until it runs out, then from the next one. a program
+// that set FIN by writing %fl stops there, since such a write always ends its block.
+#define SQUIRM_RUN_FETCH()                                                                     \
+    if (remaining == 0) {                                                                      \
+        goto exit_budget;                                                                      \
+    }                                                                                          \
+    if (pc == pc_end) {                                                                        \
+        if (cpu->reg[BURROW_REG_FL] & BURROW_FL_FIN) {                                         \
+            goto exit_fin;                                                                     \
+        }                                                                                      \
+        pc = squirm_cpu_next_block(cpu, &block, &pc_end, &single);                             \
+        if (pc == NULL) {                                                                      \
+            goto exit_fin;                                                                     \
+        }                                                                                      \
+    }                                                                                          \
+    dispatch = pc->dispatch;                                                                   \
+    op = (pc++)->op;                                                                           \
+    cpu->reg[BURROW_REG_IP] += 4;                                                              \
+    remaining--;
+
+// takes the second op of a superinstruction
+#define SQUIRM_RUN_SECOND()                                                                    \
+    if (remaining == 0) {                                                                      \
+        goto exit_budget;                                                                      \
+    }                                                                                          \
+    op = (pc++)->op;                                                                           \
+    cpu->reg[BURROW_REG_IP] += 4;                                                              \
+    remaining--;
+
+#ifdef SQUIRM_THREADED_DISPATCH
+#define SQUIRM_RUN_OP(NAME, OP) op_##NAME:
+#define SQUIRM_RUN_FUSED(NAME, FUSED) fused_##NAME:
+#define SQUIRM_RUN_NEXT()                                                                      \
+    do {                                                                                       \
+        SQUIRM_RUN_FETCH();                                                                    \
+        goto* k_op_labels[dispatch];                                                           \
+    } while (0)
+#else
+#define SQUIRM_RUN_OP(NAME, OP) case BURROW_OP_##OP:
+#define SQUIRM_RUN_FUSED(NAME, FUSED) case SQUIRM_FUSED_##FUSED:
+#define SQUIRM_RUN_NEXT() continue
+#endif
+
+// a taken `jz` skips whatever follows it in the block
+#define SQUIRM_RUN_JZ()                                                                        \
+    if (squirm_cpu_zero(cpu)) {                                                                \
+        OP_HANDLER_NAME(jz)(cpu, op);                                                          \
+        pc = pc_end;                                                                           \
+    }                                                                                          \
+    SQUIRM_RUN_NEXT();
+
+#define SQUIRM_RUN_LDI_ALU(NAME, FUSED)                                                        \
+    SQUIRM_RUN_FUSED(ldi_##NAME, FUSED) {                                                      \
+        OP_HANDLER_NAME(ldi)(cpu, op);                                                         \
+        SQUIRM_RUN_SECOND();                                                                   \
+        OP_HANDLER_NAME(NAME)(cpu, op);                                                        \
+        SQUIRM_RUN_NEXT();                                                                     \
+    }
+
+// leaves the run loop if the last memory access went through MMIO
+#define SQUIRM_RUN_CHECK_MMIO()                                                                \
+    if (cpu->mmio_accessed) {                                                                  \
+        cpu->mmio_accessed = false;                                                            \
+        result = SQUIRM_CPU_EXIT_MMIO;                                                         \
+        goto out;                                                                             \
+    }
+
+// stops right after a division by zero, instead of running the rest of the block
+#define SQUIRM_RUN_CHECK_FAULT()                                                               \
+    if (cpu->fault != SQUIRM_CPU_FAULT_NONE) {                                                 \
+        goto exit_fin;                                                                         \
+    }
+
+#define SQUIRM_RUN_LDI_DIV(NAME, FUSED)                                                        \
+    SQUIRM_RUN_FUSED(ldi_##NAME, FUSED) {                                                      \
+        OP_HANDLER_NAME(ldi)(cpu, op);                                                         \
+        SQUIRM_RUN_SECOND();                                                                   \
+        OP_HANDLER_NAME(NAME)(cpu, op);                                                        \
+        SQUIRM_RUN_CHECK_FAULT();                                                              \
+        SQUIRM_RUN_NEXT();                                                                     \
+    }
+
+// drops the rest of the current block if a store went into its code page
+#define SQUIRM_RUN_CHECK_CODE()                                                                \
+    if (block != NULL && !squirm_cpu_block_fresh(cpu, block)) {                                \
+        pc_end = pc;                                                                           \
+        block = NULL;                                                                          \
+    }
+
+#ifdef SQUIRM_THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+squirm_cpu_exit_t squirm_cpu_run(squirm_cpu_t* cpu, usize max_ops) {
+    squirm_cpu_exit_t result = SQUIRM_CPU_EXIT_BUDGET;
+    usize remaining = max_ops;
+    squirm_op_t op;
+    u8 dispatch;
+
+    squirm_block_t* block = NULL;
+    squirm_decoded_op_t* pc = NULL;
+    squirm_decoded_op_t* pc_end = NULL;
+    squirm_decoded_op_t single;
+
+    cpu->mmio_accessed = false;
+
+    if (cpu->reg[BURROW_REG_FL] & BURROW_FL_FIN) {
+        return SQUIRM_CPU_EXIT_FIN;
+    }
+
+#ifdef SQUIRM_THREADED_DISPATCH
+    // clang-format off
+    static const void* k_op_labels[SQUIRM_DISPATCH_COUNT] = {
+        [BURROW_OP_NOP] = &&op_nop,
+        [BURROW_OP_LDI] = &&op_ldi,
+        [BURROW_OP_LDR] = &&op_ldr,
+        [BURROW_OP_LDRB] = &&op_ldrb,
+        [BURROW_OP_ADD] = &&op_add,
+        [BURROW_OP_SUB] = &&op_sub,
+        [BURROW_OP_MUL] = &&op_mul,
+        [BURROW_OP_DIV] = &&op_div,
+        [BURROW_OP_MOD] = &&op_mod,
+        [BURROW_OP_AND] = &&op_and,
+        [BURROW_OP_OR] = &&op_or,
+        [BURROW_OP_XOR] = &&op_xor,
+        [BURROW_OP_SHL] = &&op_shl,
+        [BURROW_OP_SHR] = &&op_shr,
+        [BURROW_OP_JMP] = &&op_jmp,
+        [BURROW_OP_JZ] = &&op_jz,
+        [BURROW_OP_JD] = &&op_jd,
+        [BURROW_OP_STI] = &&op_sti,
+        [BURROW_OP_STIB] = &&op_stib,
+        [BURROW_OP_STR] = &&op_str,
+        [BURROW_OP_STRB] = &&op_strb,
+        [BURROW_OP_SYS] = &&op_sys,
+        [SQUIRM_FUSED_LDI_ADD] = &&fused_ldi_add,
+        [SQUIRM_FUSED_LDI_SUB] = &&fused_ldi_sub,
+        [SQUIRM_FUSED_LDI_MUL] = &&fused_ldi_mul,
+        [SQUIRM_FUSED_LDI_DIV] = &&fused_ldi_div,
+        [SQUIRM_FUSED_LDI_MOD] = &&fused_ldi_mod,
+        [SQUIRM_FUSED_LDI_AND] = &&fused_ldi_and,
+        [SQUIRM_FUSED_LDI_OR] = &&fused_ldi_or,
+        [SQUIRM_FUSED_LDI_XOR] = &&fused_ldi_xor,
+        [SQUIRM_FUSED_LDI_SHL] = &&fused_ldi_shl,
+        [SQUIRM_FUSED_LDI_SHR] = &&fused_ldi_shr,
+        [SQUIRM_FUSED_SUB_JZ] = &&fused_sub_jz,
+        [SQUIRM_FUSED_JZ_JMP] = &&fused_jz_jmp,
+    };
+    // clang-format on
+
+    SQUIRM_RUN_NEXT();
+#else
+    for (;;) {
+        SQUIRM_RUN_FETCH();
+
+        switch (dispatch) {
+#endif
+
+    SQUIRM_RUN_OP(nop, NOP) {
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(ldi, LDI) {
+        OP_HANDLER_NAME(ldi)(cpu, op);
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(ldr, LDR) {
+        OP_HANDLER_NAME(ldr)(cpu, op);
+        SQUIRM_RUN_CHECK_MMIO();
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(ldrb, LDRB) {
+        OP_HANDLER_NAME(ldrb)(cpu, op);
+        SQUIRM_RUN_CHECK_MMIO();
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(add, ADD) {
+        OP_HANDLER_NAME(add)(cpu, op);
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(sub, SUB) {
+        OP_HANDLER_NAME(sub)(cpu, op);
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(mul, MUL) {
+        OP_HANDLER_NAME(mul)(cpu, op);
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(div, DIV) {
+        OP_HANDLER_NAME(div)(cpu, op);
+        SQUIRM_RUN_CHECK_FAULT();
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(mod, MOD) {
+        OP_HANDLER_NAME(mod)(cpu, op);
+        SQUIRM_RUN_CHECK_FAULT();
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(and, AND) {
+        OP_HANDLER_NAME(and)(cpu, op);
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(or, OR) {
+        OP_HANDLER_NAME(or)(cpu, op);
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(xor, XOR) {
+        OP_HANDLER_NAME(xor)(cpu, op);
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(shl, SHL) {
+        OP_HANDLER_NAME(shl)(cpu, op);
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(shr, SHR) {
+        OP_HANDLER_NAME(shr)(cpu, op);
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(jmp, JMP) {
+        OP_HANDLER_NAME(jmp)(cpu, op);
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(jz, JZ) {
+        SQUIRM_RUN_JZ();
+    }
+    SQUIRM_RUN_OP(jd, JD) {
+        OP_HANDLER_NAME(jd)(cpu, op);
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(sti, STI) {
+        OP_HANDLER_NAME(sti)(cpu, op);
+        SQUIRM_RUN_CHECK_MMIO();
+        SQUIRM_RUN_CHECK_CODE();
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(stib, STIB) {
+        OP_HANDLER_NAME(stib)(cpu, op);
+        SQUIRM_RUN_CHECK_MMIO();
+        SQUIRM_RUN_CHECK_CODE();
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(str, STR) {
+        OP_HANDLER_NAME(str)(cpu, op);
+        SQUIRM_RUN_CHECK_MMIO();
+        SQUIRM_RUN_CHECK_CODE();
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(strb, STRB) {
+        OP_HANDLER_NAME(strb)(cpu, op);
+        SQUIRM_RUN_CHECK_MMIO();
+        SQUIRM_RUN_CHECK_CODE();
+        SQUIRM_RUN_NEXT();
+    }
+    SQUIRM_RUN_OP(sys, SYS) {
+        OP_HANDLER_NAME(sys)(cpu, op);
+
+        if (cpu->reg[BURROW_REG_FL] & BURROW_FL_FIN) {
+            result = SQUIRM_CPU_EXIT_FIN;
+        } else {
+            result = SQUIRM_CPU_EXIT_SYSCALL;
+        }
+
+        goto out;
+    }
+
+    SQUIRM_RUN_LDI_ALU(add, LDI_ADD)
+    SQUIRM_RUN_LDI_ALU(sub, LDI_SUB)
+    SQUIRM_RUN_LDI_ALU(mul, LDI_MUL)
+    SQUIRM_RUN_LDI_DIV(div, LDI_DIV)
+    SQUIRM_RUN_LDI_DIV(mod, LDI_MOD)
+    SQUIRM_RUN_LDI_ALU(and, LDI_AND)
+    SQUIRM_RUN_LDI_ALU(or, LDI_OR)
+    SQUIRM_RUN_LDI_ALU(xor, LDI_XOR)
+    SQUIRM_RUN_LDI_ALU(shl, LDI_SHL)
+    SQUIRM_RUN_LDI_ALU(shr, LDI_SHR)
+    SQUIRM_RUN_FUSED(sub_jz, SUB_JZ) {
+        OP_HANDLER_NAME(sub)(cpu, op);
+        SQUIRM_RUN_SECOND();
+        SQUIRM_RUN_JZ();
+    }
+    SQUIRM_RUN_FUSED(jz_jmp, JZ_JMP) {
+        if (squirm_cpu_zero(cpu)) {
+            OP_HANDLER_NAME(jz)(cpu, op);
+            pc = pc_end;
+            SQUIRM_RUN_NEXT();
+        }
+        SQUIRM_RUN_SECOND();
+        OP_HANDLER_NAME(jmp)(cpu, op);
+        SQUIRM_RUN_NEXT();
+    }
+
+#ifndef SQUIRM_THREADED_DISPATCH
+            default:
+                // unreachable: the opcode was validated when fetched
+                goto exit_fin;
+        }
+    }
+#endif
+
+exit_fin:
+    result = SQUIRM_CPU_EXIT_FIN;
+    goto out;
+exit_budget:
+    result = SQUIRM_CPU_EXIT_BUDGET;
+out:
+    cpu->executed_op_count += max_ops - remaining;
+    return result;
+}
+
+#ifdef SQUIRM_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
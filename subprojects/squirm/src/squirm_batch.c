@@ -0,0 +1,269 @@
+#define _POSIX_C_SOURCE 199309L
+#include "squirm_batch.h"
+
+#include "burrow.h"
+#include "log.h"
+#include "squirm.h"
+#include "types.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// instructions executed per `squirm_cpu_run` call
+#define SQUIRM_BATCH_RUN_BUDGET 0x100000
+
+typedef struct squirm_batch_worker {
+    squirm_batch_t* batch;
+    u32 index;
+} squirm_batch_worker_t;
+
+static void syscall_exit(squirm_cpu_t* cpu) {
+    cpu->reg[BURROW_REG_FL] |= BURROW_FL_FIN;
+}
+
+// captures the output into the task instead of writing it to stdout
+static void syscall_print(squirm_cpu_t* cpu) {
+    squirm_batch_task_t* task = cpu->user;
+    u16 addr = cpu->reg[BURROW_REG_B];
+    u16 len = cpu->reg[BURROW_REG_C];
+
+    for (int i = 0; i < len; i++) {
+        if (task->output_len == SQUIRM_BATCH_OUTPUT_MAX) {
+            task->output_truncated = true;
+            break;
+        }
+
+        task->output[task->output_len++] = (char)cpu->mem[(u16)(addr + i)];
+    }
+
+    cpu->reg[BURROW_REG_A] = 0;
+}
+
+static u64 squirm_batch_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (u64)now.tv_sec * 1000000 + (u64)now.tv_nsec / 1000;
+}
+
+squirm_batch_t* squirm_batch_new(
+    squirm_batch_task_t* tasks,
+    usize task_count,
+    u32 thread_count,
+    u64 max_ops,
+    FILE* out
+) {
+    squirm_batch_t* batch = malloc(sizeof(squirm_batch_t));
+
+    if (batch == NULL) {
+        LOG_ERROR("Failed to allocate memory for batch\n");
+        exit(1);
+    }
+
+    // idle threads would only spin looking for work to steal
+    if (thread_count > task_count) {
+        thread_count = (u32)task_count;
+    }
+
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+
+    batch->tasks = tasks;
+    batch->task_count = task_count;
+    batch->max_ops = max_ops;
+    batch->thread_count = thread_count;
+    batch->out = out;
+    pthread_mutex_init(&batch->out_lock, NULL);
+
+    batch->queues = malloc(sizeof(squirm_batch_queue_t) * thread_count);
+
+    if (batch->queues == NULL) {
+        LOG_ERROR("Failed to allocate memory for batch queues\n");
+        exit(1);
+    }
+
+    for (u32 i = 0; i < thread_count; i++) {
+        squirm_batch_queue_t* queue = &batch->queues[i];
+
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->head = task_count * i / thread_count;
+        queue->tail = task_count * (i + 1) / thread_count;
+    }
+
+    return batch;
+}
+
+void squirm_batch_free(squirm_batch_t* batch) {
+    for (u32 i = 0; i < batch->thread_count; i++) {
+        pthread_mutex_destroy(&batch->queues[i].lock);
+    }
+
+    pthread_mutex_destroy(&batch->out_lock);
+    free(batch->queues);
+    free(batch);
+}
+
+// takes the next task of the worker's own queue, or steals the last task of another one.
+// returns false once every queue is empty.
+static bool squirm_batch_take(squirm_batch_t* batch, u32 worker, usize* task) {
+    for (u32 i = 0; i < batch->thread_count; i++) {
+        u32 index = (worker + i) % batch->thread_count;
+        squirm_batch_queue_t* queue = &batch->queues[index];
+        bool found = false;
+
+        pthread_mutex_lock(&queue->lock);
+
+        if (queue->head < queue->tail) {
+            *task = index == worker ? queue->head++ : --queue->tail;
+            found = true;
+        }
+
+        pthread_mutex_unlock(&queue->lock);
+
+        if (found) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void squirm_batch_run_task(squirm_batch_t* batch, squirm_batch_task_t* task) {
+    u64 start = squirm_batch_now_us();
+
+    squirm_cpu_t* cpu =
+        squirm_cpu_new((squirm_cpu_syscall_fn[]){ syscall_exit, syscall_print }, 2);
+    cpu->user = task;
+
+    squirm_cpu_load(cpu, task->rom, (u16)task->rom_size);
+    squirm_cpu_reset(cpu);
+
+    if (task->seeded) {
+        cpu->reg[BURROW_REG_A] = task->seed;
+    }
+
+    task->finished = false;
+
+    while (batch->max_ops == 0 || cpu->executed_op_count < batch->max_ops) {
+        u64 budget = SQUIRM_BATCH_RUN_BUDGET;
+
+        if (batch->max_ops != 0 && batch->max_ops - cpu->executed_op_count < budget) {
+            budget = batch->max_ops - cpu->executed_op_count;
+        }
+
+        if (squirm_cpu_run(cpu, budget) == SQUIRM_CPU_EXIT_FIN) {
+            task->finished = true;
+            break;
+        }
+    }
+
+    task->executed_op_count = cpu->executed_op_count;
+    task->fault = cpu->fault;
+    squirm_cpu_free(cpu);
+
+    task->wall_us = squirm_batch_now_us() - start;
+}
+
+static void squirm_batch_write_string(FILE* out, const char* str, usize len) {
+    putc('"', out);
+
+    for (usize i = 0; i < len; i++) {
+        u8 c = (u8)str[i];
+
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c == '\n') {
+            fputs("\\n", out);
+        } else if (c < 0x20 || c >= 0x7f) {
+            // bytes above ASCII are passed through as code points, the output isn't UTF-8
+            fprintf(out, "\\u%04x", c);
+        } else {
+            putc(c, out);
+        }
+    }
+
+    putc('"', out);
+}
+
+// writes one JSON line with the results of a task
+static void squirm_batch_report(squirm_batch_t* batch, usize index) {
+    const squirm_batch_task_t* task = &batch->tasks[index];
+    FILE* out = batch->out;
+
+    pthread_mutex_lock(&batch->out_lock);
+
+    fprintf(out, "{\"task\":%zu,\"rom\":", index);
+    squirm_batch_write_string(out, task->rom_file, strlen(task->rom_file));
+
+    if (task->seeded) {
+        fprintf(out, ",\"seed\":%u", task->seed);
+    }
+
+    const char* status = task->fault != SQUIRM_CPU_FAULT_NONE ? "fault"
+                       : task->finished                      ? "fin"
+                                                             : "limit";
+
+    fprintf(
+        out,
+        ",\"instructions\":%" PRIu64 ",\"exit\":\"%s\"",
+        task->executed_op_count,
+        status
+    );
+
+    if (task->fault != SQUIRM_CPU_FAULT_NONE) {
+        fprintf(out, ",\"fault\":\"%s\"", squirm_cpu_fault_str(task->fault));
+    }
+
+    fprintf(out, ",\"wall_us\":%" PRIu64 ",\"output\":", task->wall_us);
+    squirm_batch_write_string(out, task->output, task->output_len);
+    fprintf(out, ",\"output_truncated\":%s}\n", task->output_truncated ? "true" : "false");
+    fflush(out);
+
+    pthread_mutex_unlock(&batch->out_lock);
+}
+
+static void* squirm_batch_worker(void* data) {
+    squirm_batch_worker_t* worker = data;
+    squirm_batch_t* batch = worker->batch;
+    usize index;
+
+    while (squirm_batch_take(batch, worker->index, &index)) {
+        squirm_batch_run_task(batch, &batch->tasks[index]);
+        squirm_batch_report(batch, index);
+    }
+
+    return NULL;
+}
+
+// runs every task and returns once they are all done
+void squirm_batch_run(squirm_batch_t* batch) {
+    pthread_t* threads = malloc(sizeof(pthread_t) * batch->thread_count);
+    squirm_batch_worker_t* workers =
+        malloc(sizeof(squirm_batch_worker_t) * batch->thread_count);
+
+    if (threads == NULL || workers == NULL) {
+        LOG_ERROR("Failed to allocate memory for batch workers\n");
+        exit(1);
+    }
+
+    for (u32 i = 0; i < batch->thread_count; i++) {
+        workers[i] = (squirm_batch_worker_t){ .batch = batch, .index = i };
+
+        if (pthread_create(&threads[i], NULL, squirm_batch_worker, &workers[i]) != 0) {
+            LOG_ERROR("Failed to create batch worker thread\n");
+            exit(1);
+        }
+    }
+
+    for (u32 i = 0; i < batch->thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(workers);
+    free(threads);
+}
@@ -77,10 +77,6 @@ void squirm_dbg_free(squirm_dbg_t* dbg) {
     free(dbg);
 }
 
-static inline u16 squirm_op_imm(squirm_op_t op) {
-    return (op.args.src_a << 8) | (op.args.src_b & 0xFF);
-}
-
 static inline u8 squirm_cpu_read8(squirm_cpu_t* cpu, u16 addr) {
     return cpu->mem[addr];
 }
@@ -118,6 +114,7 @@ void squirm_dbg_prompt(squirm_dbg_t* dbg) {
         dbg->running = true;
         LOG_DEBUG("Continuing...\n");
         squirm_cpu_step(dbg->cpu);
+        squirm_cpu_sync_flags(dbg->cpu);
     } else if (strcmp(cmd_name, "s") == 0 || strcmp(cmd_name, "step") == 0) {
         squirm_cpu_step(dbg->cpu);
     } else if (strcmp(cmd_name, "b") == 0 || strcmp(cmd_name, "break") == 0) {
@@ -268,7 +265,7 @@ void squirm_dbg_step(squirm_dbg_t* dbg) {
         squirm_op_t op = squirm_cpu_decode_op(dbg->cpu);
 
         if (op.op == BURROW_OP_STI) {
-            u16 dest = squirm_op_imm(op);
+            u16 dest = op.imm;
 
             if (squirm_dbg_watchpoint_check(dbg, dest) ||
                 squirm_dbg_watchpoint_check(dbg, dest + 1)) {
@@ -277,7 +274,7 @@ void squirm_dbg_step(squirm_dbg_t* dbg) {
                 return;
             }
         } else if (op.op == BURROW_OP_STIB) {
-            u16 dest = squirm_op_imm(op);
+            u16 dest = op.imm;
 
             if (squirm_dbg_watchpoint_check(dbg, dest)) {
                 dbg->running = false;
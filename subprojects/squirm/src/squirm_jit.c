@@ -0,0 +1,874 @@
+#define _DEFAULT_SOURCE
+#include "squirm_jit.h"
+#include "burrow.h"
+#include "log.h"
+#include "squirm.h"
+#include "types.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Generated code conventions:
+// - rbx holds the `squirm_cpu_t*`, so registers are `[rbx + reg * 2]`
+// - r12 holds the remaining instruction budget
+// - r13 points to the caller's budget variable, written back on exit
+// - r14d caches %fl, written back on exit and around calls into the interpreter
+// - eax, ecx, edx, rsi, rdi are scratch
+//
+// Every block starts by checking that its code page wasn't written to since it was
+// translated, and by taking its instruction count out of the budget. Exits from the
+// generated code go through one of the stubs behind the trampoline, which report why
+// the dispatcher got control back.
+
+// the generated code wants the dispatcher to look up %ip again
+#define SQUIRM_JIT_EXIT_DISPATCH 0xff
+
+// worst-case size of one translated block, including its cold paths
+#define SQUIRM_JIT_MAX_BLOCK_SIZE (SQUIRM_JIT_MAX_BLOCK_OPS * 160 + 256)
+
+// size of the page generation check at the start of every block
+#define SQUIRM_JIT_GEN_CHECK_SIZE 16
+
+#define SQUIRM_JIT_REG(REG) ((u8)(offsetof(squirm_cpu_t, reg) + (REG)*2))
+#define SQUIRM_JIT_IP SQUIRM_JIT_REG(BURROW_REG_IP)
+#define SQUIRM_JIT_FL SQUIRM_JIT_REG(BURROW_REG_FL)
+
+_Static_assert(
+    offsetof(squirm_cpu_t, reg) + sizeof(((squirm_cpu_t*)0)->reg) <= 0x80,
+    "the register file must be addressable with 8-bit displacements"
+);
+
+typedef enum squirm_jit_cold_kind {
+    SQUIRM_JIT_COLD_STALE,
+    SQUIRM_JIT_COLD_BUDGET,
+    SQUIRM_JIT_COLD_MMIO,
+    SQUIRM_JIT_COLD_SMC,
+    SQUIRM_JIT_COLD_DIV_ZERO,
+    SQUIRM_JIT_COLD_LINK,
+} squirm_jit_cold_kind_t;
+
+// an out-of-line path of a block, emitted after its body
+typedef struct squirm_jit_cold {
+    squirm_jit_cold_kind_t kind;
+    usize site;    // rel32 in the body jumping to this path
+    u32 remaining; // instructions of the block that won't run
+    u32 packed;    // op for the interpreter, see `squirm_jit_pack`
+    u16 ip;
+} squirm_jit_cold_t;
+
+typedef struct squirm_jit_ctx {
+    squirm_jit_t* jit;
+    u16 start;
+    u32 len;
+    u32 gen;
+    u32 gen_offset;
+
+    squirm_jit_cold_t cold[SQUIRM_JIT_MAX_BLOCK_OPS * 3 + 2];
+    usize cold_len;
+} squirm_jit_ctx_t;
+
+static inline void squirm_jit_emit(squirm_jit_t* jit, const u8* bytes, usize len) {
+    memcpy(jit->code + jit->code_len, bytes, len);
+    jit->code_len += len;
+}
+
+#define SQUIRM_JIT_EMIT(JIT, ...)                                                              \
+    squirm_jit_emit((JIT), (const u8[]){ __VA_ARGS__ }, sizeof((const u8[]){ __VA_ARGS__ }))
+
+static inline void squirm_jit_emit16(squirm_jit_t* jit, u16 value) {
+    squirm_jit_emit(jit, (const u8*)&value, sizeof(value));
+}
+
+static inline void squirm_jit_emit32(squirm_jit_t* jit, u32 value) {
+    squirm_jit_emit(jit, (const u8*)&value, sizeof(value));
+}
+
+static inline void squirm_jit_emit64(squirm_jit_t* jit, u64 value) {
+    squirm_jit_emit(jit, (const u8*)&value, sizeof(value));
+}
+
+// emits a zeroed rel32 and returns its offset, to be patched later
+static inline usize squirm_jit_emit_rel32(squirm_jit_t* jit) {
+    usize site = jit->code_len;
+    squirm_jit_emit32(jit, 0);
+    return site;
+}
+
+static inline void squirm_jit_patch_rel32(squirm_jit_t* jit, usize site, const u8* target) {
+    i32 rel = (i32)(target - (jit->code + site + 4));
+    memcpy(jit->code + site, &rel, sizeof(rel));
+}
+
+static inline void squirm_jit_emit_jmp(squirm_jit_t* jit, const u8* target) {
+    SQUIRM_JIT_EMIT(jit, 0xe9);
+    squirm_jit_patch_rel32(jit, squirm_jit_emit_rel32(jit), target);
+}
+
+static inline void squirm_jit_emit_cold_jcc(
+    squirm_jit_ctx_t* ctx,
+    u8 cc,
+    squirm_jit_cold_t cold
+) {
+    SQUIRM_JIT_EMIT(ctx->jit, 0x0f, cc);
+    cold.site = squirm_jit_emit_rel32(ctx->jit);
+    ctx->cold[ctx->cold_len++] = cold;
+}
+
+#define SQUIRM_JIT_CC_B 0x82
+#define SQUIRM_JIT_CC_Z 0x84
+#define SQUIRM_JIT_CC_NZ 0x85
+
+// mov word [rbx + IP], ip
+static inline void squirm_jit_emit_set_ip(squirm_jit_t* jit, u16 ip) {
+    SQUIRM_JIT_EMIT(jit, 0x66, 0xc7, 0x43, SQUIRM_JIT_IP);
+    squirm_jit_emit16(jit, ip);
+}
+
+// cmp dword [rbx + gen], gen
+static inline void squirm_jit_emit_gen_check(squirm_jit_ctx_t* ctx) {
+    SQUIRM_JIT_EMIT(ctx->jit, 0x81, 0xbb);
+    squirm_jit_emit32(ctx->jit, ctx->gen_offset);
+    squirm_jit_emit32(ctx->jit, ctx->gen);
+}
+
+static inline u32 squirm_jit_pack(squirm_op_t op) {
+    return (u32)op.op | ((u32)op.args.dest << 8) | ((u32)op.args.src_a << 16) |
+           ((u32)op.args.src_b << 24);
+}
+
+// called from generated code for instructions left to the interpreter
+static void squirm_jit_exec(squirm_cpu_t* cpu, u32 packed) {
+    squirm_op_t op = squirm_op_new(
+        packed & 0xff,
+        (packed >> 8) & 0xff,
+        (packed >> 16) & 0xff,
+        (packed >> 24) & 0xff
+    );
+
+    squirm_cpu_exec(cpu, op);
+}
+
+// mov [rbx + FL], r14w
+static inline void squirm_jit_emit_store_flags(squirm_jit_t* jit) {
+    SQUIRM_JIT_EMIT(jit, 0x66, 0x44, 0x89, 0x73, SQUIRM_JIT_FL);
+}
+
+// movzx r14d, word [rbx + FL]
+static inline void squirm_jit_emit_load_flags(squirm_jit_t* jit) {
+    SQUIRM_JIT_EMIT(jit, 0x44, 0x0f, 0xb7, 0x73, SQUIRM_JIT_FL);
+}
+
+// mov rdi, rbx; mov esi, packed; mov rax, squirm_jit_exec; call rax
+static void squirm_jit_emit_exec(squirm_jit_t* jit, u32 packed) {
+    squirm_jit_emit_store_flags(jit);
+    SQUIRM_JIT_EMIT(jit, 0x48, 0x89, 0xdf);
+    SQUIRM_JIT_EMIT(jit, 0xbe);
+    squirm_jit_emit32(jit, packed);
+    SQUIRM_JIT_EMIT(jit, 0x48, 0xb8);
+    squirm_jit_emit64(jit, (u64)(uintptr_t)&squirm_jit_exec);
+    SQUIRM_JIT_EMIT(jit, 0xff, 0xd0);
+    squirm_jit_emit_load_flags(jit);
+}
+
+static void squirm_jit_emit_runtime(squirm_jit_t* jit) {
+    u8* enter = jit->code + jit->code_len;
+
+    // push rbx; push r12; push r13; push r14; sub rsp, 8
+    SQUIRM_JIT_EMIT(jit, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x48, 0x83, 0xec, 0x08);
+    // mov rbx, rdi; mov r13, rdx; mov r12, [r13]
+    SQUIRM_JIT_EMIT(jit, 0x48, 0x89, 0xfb, 0x49, 0x89, 0xd5, 0x4d, 0x8b, 0x65, 0x00);
+    squirm_jit_emit_load_flags(jit);
+    // jmp rsi
+    SQUIRM_JIT_EMIT(jit, 0xff, 0xe6);
+
+    u8* exit_common = jit->code + jit->code_len;
+
+    // mov [r13], r12
+    SQUIRM_JIT_EMIT(jit, 0x4d, 0x89, 0x65, 0x00);
+    squirm_jit_emit_store_flags(jit);
+    // add rsp, 8; pop r14; pop r13
+    SQUIRM_JIT_EMIT(jit, 0x48, 0x83, 0xc4, 0x08, 0x41, 0x5e, 0x41, 0x5d);
+    // pop r12; pop rbx; ret
+    SQUIRM_JIT_EMIT(jit, 0x41, 0x5c, 0x5b, 0xc3);
+
+    jit->exit_budget = jit->code + jit->code_len;
+    SQUIRM_JIT_EMIT(jit, 0xb8);
+    squirm_jit_emit32(jit, SQUIRM_CPU_EXIT_BUDGET);
+    squirm_jit_emit_jmp(jit, exit_common);
+
+    jit->exit_mmio = jit->code + jit->code_len;
+    SQUIRM_JIT_EMIT(jit, 0xb8);
+    squirm_jit_emit32(jit, SQUIRM_CPU_EXIT_MMIO);
+    squirm_jit_emit_jmp(jit, exit_common);
+
+    jit->exit_dispatch = jit->code + jit->code_len;
+    SQUIRM_JIT_EMIT(jit, 0xb8);
+    squirm_jit_emit32(jit, SQUIRM_JIT_EXIT_DISPATCH);
+    squirm_jit_emit_jmp(jit, exit_common);
+
+    // ISO C has no conversion from object to function pointers
+    memcpy(&jit->enter, &enter, sizeof(jit->enter));
+
+    jit->code_start = jit->code_len;
+}
+
+squirm_jit_t* squirm_jit_new(squirm_cpu_t* cpu) {
+    squirm_jit_t* jit = malloc(sizeof(squirm_jit_t));
+
+    if (jit == NULL) {
+        LOG_ERROR("Failed to allocate memory for jit\n");
+        exit(1);
+    }
+
+    jit->cpu = cpu;
+
+    jit->code = mmap(
+        NULL,
+        SQUIRM_JIT_CODE_SIZE,
+        PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0
+    );
+
+    if (jit->code == MAP_FAILED) {
+        LOG_ERROR("Failed to map jit code buffer\n");
+        exit(1);
+    }
+
+    jit->code_len = 0;
+    squirm_jit_emit_runtime(jit);
+
+    jit->links_cap = 256;
+    jit->links = malloc(sizeof(squirm_jit_link_t) * jit->links_cap);
+
+    if (jit->links == NULL) {
+        LOG_ERROR("Failed to allocate memory for jit links\n");
+        exit(1);
+    }
+
+    squirm_jit_flush(jit);
+
+    return jit;
+}
+
+void squirm_jit_free(squirm_jit_t* jit) {
+    munmap(jit->code, SQUIRM_JIT_CODE_SIZE);
+    free(jit->links);
+    free(jit);
+}
+
+// drops every translation
+void squirm_jit_flush(squirm_jit_t* jit) {
+    jit->code_len = jit->code_start;
+
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->native, 0, sizeof(jit->native));
+    memset(jit->link_heads, 0, sizeof(jit->link_heads));
+    jit->links_len = 0;
+}
+
+static void squirm_jit_add_link(squirm_jit_t* jit, u16 target, usize site) {
+    if (jit->links_len >= jit->links_cap) {
+        usize cap = jit->links_cap * 2;
+        squirm_jit_link_t* links = realloc(jit->links, sizeof(squirm_jit_link_t) * cap);
+
+        if (links == NULL) {
+            LOG_ERROR("Failed to grow jit links\n");
+            exit(1);
+        }
+
+        jit->links = links;
+        jit->links_cap = cap;
+    }
+
+    u32 slot = target / 4;
+
+    jit->links[jit->links_len].site = (u32)site;
+    jit->links[jit->links_len].next = jit->link_heads[slot];
+    jit->link_heads[slot] = (u32)++jit->links_len;
+}
+
+static void squirm_jit_resolve_links(squirm_jit_t* jit, u16 target, const u8* entry) {
+    u32 slot = target / 4;
+    u32 link = jit->link_heads[slot];
+
+    while (link != 0) {
+        squirm_jit_patch_rel32(jit, jit->links[link - 1].site, entry);
+        link = jit->links[link - 1].next;
+    }
+
+    jit->link_heads[slot] = 0;
+}
+
+static inline bool squirm_jit_block_fresh(squirm_jit_t* jit, u16 ip) {
+    squirm_jit_block_t* block = &jit->blocks[ip / 4];
+
+    return block->valid && block->gen == jit->cpu->code_page_gen[ip / SQUIRM_CODE_PAGE_SIZE];
+}
+
+// jumps to the block at `target`, directly if it's already translated
+static void squirm_jit_emit_link(squirm_jit_ctx_t* ctx, u16 target) {
+    squirm_jit_t* jit = ctx->jit;
+
+    SQUIRM_JIT_EMIT(jit, 0xe9);
+    usize site = squirm_jit_emit_rel32(jit);
+
+    bool linkable = target % 4 == 0 && target <= BURROW_MEM_CODE_END &&
+                    squirm_jit_block_fresh(jit, target);
+
+    if (linkable && jit->blocks[target / 4].entry != NULL) {
+        u8* entry = jit->blocks[target / 4].entry;
+
+        // a block on the same page can't be stale while this one runs, skip its check
+        if (target / SQUIRM_CODE_PAGE_SIZE == ctx->start / SQUIRM_CODE_PAGE_SIZE) {
+            entry += SQUIRM_JIT_GEN_CHECK_SIZE;
+        }
+
+        squirm_jit_patch_rel32(jit, site, entry);
+        return;
+    }
+
+    ctx->cold[ctx->cold_len++] = (squirm_jit_cold_t){
+        .kind = SQUIRM_JIT_COLD_LINK,
+        .site = site,
+        .ip = target,
+    };
+}
+
+static void squirm_jit_emit_cold(squirm_jit_ctx_t* ctx) {
+    squirm_jit_t* jit = ctx->jit;
+
+    for (usize i = 0; i < ctx->cold_len; i++) {
+        squirm_jit_cold_t* cold = &ctx->cold[i];
+
+        squirm_jit_patch_rel32(jit, cold->site, jit->code + jit->code_len);
+
+        switch (cold->kind) {
+            case SQUIRM_JIT_COLD_STALE:
+                squirm_jit_emit_set_ip(jit, ctx->start);
+                squirm_jit_emit_jmp(jit, jit->exit_dispatch);
+                break;
+            case SQUIRM_JIT_COLD_BUDGET:
+                // add r12, len
+                SQUIRM_JIT_EMIT(jit, 0x49, 0x81, 0xc4);
+                squirm_jit_emit32(jit, ctx->len);
+                squirm_jit_emit_set_ip(jit, ctx->start);
+                squirm_jit_emit_jmp(jit, jit->exit_budget);
+                break;
+            case SQUIRM_JIT_COLD_MMIO:
+            case SQUIRM_JIT_COLD_SMC:
+                // add r12, remaining
+                SQUIRM_JIT_EMIT(jit, 0x49, 0x81, 0xc4);
+                squirm_jit_emit32(jit, cold->remaining);
+                squirm_jit_emit_jmp(
+                    jit,
+                    cold->kind == SQUIRM_JIT_COLD_MMIO ? jit->exit_mmio : jit->exit_dispatch
+                );
+                break;
+            case SQUIRM_JIT_COLD_DIV_ZERO:
+                // the rest of the block never runs, the interpreter faults on the division
+                // add r12, remaining
+                SQUIRM_JIT_EMIT(jit, 0x49, 0x81, 0xc4);
+                squirm_jit_emit32(jit, cold->remaining);
+                squirm_jit_emit_set_ip(jit, cold->ip);
+                squirm_jit_emit_exec(jit, cold->packed);
+                squirm_jit_emit_jmp(jit, jit->exit_dispatch);
+                break;
+            case SQUIRM_JIT_COLD_LINK:
+                squirm_jit_emit_set_ip(jit, cold->ip);
+                squirm_jit_emit_jmp(jit, jit->exit_dispatch);
+
+                if (cold->ip % 4 == 0 && cold->ip <= BURROW_MEM_CODE_END) {
+                    squirm_jit_add_link(jit, cold->ip, cold->site);
+                }
+                break;
+        }
+    }
+}
+
+static inline squirm_op_t squirm_jit_decode(squirm_cpu_t* cpu, u16 ip) {
+    return squirm_op_new(cpu->mem[ip], cpu->mem[ip + 1], cpu->mem[ip + 2], cpu->mem[ip + 3]);
+}
+
+static inline bool squirm_jit_is_alu(u8 op) {
+    return op >= BURROW_OP_ADD && op <= BURROW_OP_SHR;
+}
+
+static bool squirm_jit_can_translate(squirm_op_t op) {
+    switch (op.op) {
+        case BURROW_OP_NOP:
+        case BURROW_OP_JMP:
+        case BURROW_OP_JZ:
+            return true;
+        case BURROW_OP_LDI:
+        case BURROW_OP_JD:
+        case BURROW_OP_LDR:
+        case BURROW_OP_LDRB:
+        case BURROW_OP_STI:
+        case BURROW_OP_STIB:
+            return op.args.dest < BURROW_REG_COUNT;
+        case BURROW_OP_STR:
+        case BURROW_OP_STRB:
+            return op.args.dest < BURROW_REG_COUNT && op.args.src_a < BURROW_REG_COUNT;
+        default:
+            if (squirm_jit_is_alu(op.op)) {
+                return op.args.dest < BURROW_REG_COUNT && op.args.src_a < BURROW_REG_COUNT &&
+                       op.args.src_b < BURROW_REG_COUNT;
+            }
+
+            // `sys` and invalid opcodes
+            return false;
+    }
+}
+
+// writes to %fl end the block too, since they may set FIN
+static bool squirm_jit_ends_block(squirm_op_t op) {
+    bool writes_control = op.args.dest == BURROW_REG_IP || op.args.dest == BURROW_REG_FL;
+
+    switch (op.op) {
+        case BURROW_OP_JMP:
+        case BURROW_OP_JZ:
+        case BURROW_OP_JD:
+            return true;
+        case BURROW_OP_LDI:
+        case BURROW_OP_LDR:
+        case BURROW_OP_LDRB:
+            return writes_control;
+        default:
+            return squirm_jit_is_alu(op.op) && writes_control;
+    }
+}
+
+// collects ZERO, CARRY, OVERFLOW and SIGN from the host flags into ecx.
+// ecx and edx must be zero. the host flags of 16-bit add, sub, and, or and xor match burrow's.
+static void squirm_jit_emit_host_flags(squirm_jit_t* jit) {
+    // setz cl; setc dl; lea ecx, [rcx + rdx * 2]
+    SQUIRM_JIT_EMIT(jit, 0x0f, 0x94, 0xc1, 0x0f, 0x92, 0xc2, 0x8d, 0x0c, 0x51);
+    // seto dl; lea ecx, [rcx + rdx * 4]
+    SQUIRM_JIT_EMIT(jit, 0x0f, 0x90, 0xc2, 0x8d, 0x0c, 0x91);
+    // sets dl; lea ecx, [rcx + rdx * 8]
+    SQUIRM_JIT_EMIT(jit, 0x0f, 0x98, 0xc2, 0x8d, 0x0c, 0xd1);
+}
+
+// adds ZERO and SIGN of the result in ax to the flags in ecx. both are taken from the same
+// test, before anything else touches the host flags.
+static void squirm_jit_emit_result_flags(squirm_jit_t* jit) {
+    // xor edx, edx; xor esi, esi; test ax, ax; setz dl; sets sil
+    SQUIRM_JIT_EMIT(jit, 0x31, 0xd2, 0x31, 0xf6, 0x66, 0x85, 0xc0, 0x0f, 0x94, 0xc2);
+    SQUIRM_JIT_EMIT(jit, 0x40, 0x0f, 0x98, 0xc6);
+    // or ecx, edx; lea ecx, [rcx + rsi * 8]
+    SQUIRM_JIT_EMIT(jit, 0x09, 0xd1, 0x8d, 0x0c, 0xf1);
+}
+
+// clears eax if the shift count in ecx was 32 or more, which the host masks to 5 bits
+static void squirm_jit_emit_shift_mask(squirm_jit_t* jit) {
+    // cmp ecx, 32; sbb edx, edx; and eax, edx
+    SQUIRM_JIT_EMIT(jit, 0x83, 0xf9, 0x20, 0x19, 0xd2, 0x21, 0xd0);
+}
+
+static void
+squirm_jit_emit_alu(squirm_jit_ctx_t* ctx, squirm_op_t op, u16 next, u32 remaining) {
+    squirm_jit_t* jit = ctx->jit;
+    u8 a = SQUIRM_JIT_REG(op.args.src_a);
+    u8 b = SQUIRM_JIT_REG(op.args.src_b);
+    u8 dest = SQUIRM_JIT_REG(op.args.dest);
+
+    // the interpreter has already moved %ip past the op when it reads it
+    if (op.args.src_a == BURROW_REG_IP || op.args.src_b == BURROW_REG_IP) {
+        squirm_jit_emit_set_ip(jit, next);
+    }
+
+    if (op.args.src_a == BURROW_REG_FL || op.args.src_b == BURROW_REG_FL) {
+        squirm_jit_emit_store_flags(jit);
+    }
+
+    // xor ecx, ecx; xor edx, edx
+    SQUIRM_JIT_EMIT(jit, 0x31, 0xc9, 0x31, 0xd2);
+    // movzx eax, word [rbx + a]
+    SQUIRM_JIT_EMIT(jit, 0x0f, 0xb7, 0x43, a);
+
+    // each case leaves the result in ax and the flags it sets in ecx
+    switch (op.op) {
+        case BURROW_OP_ADD:
+            // add ax, [rbx + b]
+            SQUIRM_JIT_EMIT(jit, 0x66, 0x03, 0x43, b);
+            squirm_jit_emit_host_flags(jit);
+            break;
+        case BURROW_OP_SUB:
+            // sub ax, [rbx + b]
+            SQUIRM_JIT_EMIT(jit, 0x66, 0x2b, 0x43, b);
+            squirm_jit_emit_host_flags(jit);
+            break;
+        case BURROW_OP_AND:
+            // and ax, [rbx + b]
+            SQUIRM_JIT_EMIT(jit, 0x66, 0x23, 0x43, b);
+            squirm_jit_emit_host_flags(jit);
+            break;
+        case BURROW_OP_OR:
+            // or ax, [rbx + b]
+            SQUIRM_JIT_EMIT(jit, 0x66, 0x0b, 0x43, b);
+            squirm_jit_emit_host_flags(jit);
+            break;
+        case BURROW_OP_XOR:
+            // xor ax, [rbx + b]
+            SQUIRM_JIT_EMIT(jit, 0x66, 0x33, 0x43, b);
+            squirm_jit_emit_host_flags(jit);
+            break;
+        case BURROW_OP_MUL:
+            // movzx ecx, word [rbx + b]; imul eax, ecx
+            SQUIRM_JIT_EMIT(jit, 0x0f, 0xb7, 0x4b, b, 0x0f, 0xaf, 0xc1);
+            // test eax, 0xffff0000; setnz dl; imul ecx, edx, CARRY | OVERFLOW
+            SQUIRM_JIT_EMIT(jit, 0xa9, 0x00, 0x00, 0xff, 0xff, 0x0f, 0x95, 0xc2);
+            SQUIRM_JIT_EMIT(jit, 0x6b, 0xca, BURROW_FL_CARRY | BURROW_FL_OVERFLOW);
+            squirm_jit_emit_result_flags(jit);
+            break;
+        case BURROW_OP_SHL:
+            // movzx ecx, word [rbx + b]; shl eax, cl
+            SQUIRM_JIT_EMIT(jit, 0x0f, 0xb7, 0x4b, b, 0xd3, 0xe0);
+            squirm_jit_emit_shift_mask(jit);
+            // mov edx, eax; shr edx, 16
+            SQUIRM_JIT_EMIT(jit, 0x89, 0xc2, 0xc1, 0xea, 0x10);
+            // and edx, 1; lea ecx, [rdx + rdx]
+            SQUIRM_JIT_EMIT(jit, 0x83, 0xe2, 0x01, 0x8d, 0x0c, 0x12);
+            squirm_jit_emit_result_flags(jit);
+            break;
+        case BURROW_OP_SHR:
+            // shift one bit further left first, so the last bit shifted out stays in bit 0
+            // movzx ecx, word [rbx + b]; add eax, eax; shr eax, cl
+            SQUIRM_JIT_EMIT(jit, 0x0f, 0xb7, 0x4b, b, 0x01, 0xc0, 0xd3, 0xe8);
+            squirm_jit_emit_shift_mask(jit);
+            // mov edx, eax; and edx, 1; shr eax, 1; lea ecx, [rdx + rdx]
+            SQUIRM_JIT_EMIT(jit, 0x89, 0xc2, 0x83, 0xe2, 0x01, 0xd1, 0xe8, 0x8d, 0x0c, 0x12);
+            squirm_jit_emit_result_flags(jit);
+            break;
+        case BURROW_OP_DIV:
+        case BURROW_OP_MOD:
+            // movzx ecx, word [rbx + b]; test ecx, ecx
+            SQUIRM_JIT_EMIT(jit, 0x0f, 0xb7, 0x4b, b, 0x85, 0xc9);
+            squirm_jit_emit_cold_jcc(
+                ctx,
+                SQUIRM_JIT_CC_Z,
+                (squirm_jit_cold_t){
+                    .kind = SQUIRM_JIT_COLD_DIV_ZERO,
+                    .packed = squirm_jit_pack(op),
+                    .ip = next,
+                    .remaining = remaining,
+                }
+            );
+            // xor edx, edx; div ecx
+            SQUIRM_JIT_EMIT(jit, 0x31, 0xd2, 0xf7, 0xf1);
+
+            if (op.op == BURROW_OP_MOD) {
+                // mov eax, edx
+                SQUIRM_JIT_EMIT(jit, 0x89, 0xd0);
+            }
+
+            // xor ecx, ecx
+            SQUIRM_JIT_EMIT(jit, 0x31, 0xc9);
+            squirm_jit_emit_result_flags(jit);
+            break;
+    }
+
+    // and r14d, ~(ZERO | CARRY | OVERFLOW | SIGN); or r14d, ecx
+    SQUIRM_JIT_EMIT(jit, 0x41, 0x83, 0xe6, 0xf0, 0x41, 0x09, 0xce);
+    // mov [rbx + dest], ax
+    SQUIRM_JIT_EMIT(jit, 0x66, 0x89, 0x43, dest);
+
+    if (op.args.dest == BURROW_REG_FL) {
+        squirm_jit_emit_load_flags(jit);
+    }
+}
+
+static void
+squirm_jit_emit_mem(squirm_jit_ctx_t* ctx, squirm_op_t op, u16 next, u32 remaining) {
+    squirm_jit_t* jit = ctx->jit;
+
+    squirm_jit_emit_set_ip(jit, next);
+    squirm_jit_emit_exec(jit, squirm_jit_pack(op));
+
+    // cmp byte [rbx + mmio_accessed], 0
+    SQUIRM_JIT_EMIT(jit, 0x80, 0xbb);
+    squirm_jit_emit32(jit, (u32)offsetof(squirm_cpu_t, mmio_accessed));
+    SQUIRM_JIT_EMIT(jit, 0x00);
+    squirm_jit_emit_cold_jcc(
+        ctx,
+        SQUIRM_JIT_CC_NZ,
+        (squirm_jit_cold_t){ .kind = SQUIRM_JIT_COLD_MMIO, .remaining = remaining }
+    );
+
+    bool may_hit_block = false;
+    u16 page = ctx->start / SQUIRM_CODE_PAGE_SIZE;
+
+    switch (op.op) {
+        case BURROW_OP_STI:
+            may_hit_block = (u16)(op.imm + 1) / SQUIRM_CODE_PAGE_SIZE == page;
+            // fallthrough
+        case BURROW_OP_STIB:
+            may_hit_block = may_hit_block || op.imm / SQUIRM_CODE_PAGE_SIZE == page;
+            break;
+        case BURROW_OP_STR:
+        case BURROW_OP_STRB:
+            may_hit_block = true;
+            break;
+    }
+
+    if (may_hit_block) {
+        // the rest of this block may have been overwritten
+        squirm_jit_emit_gen_check(ctx);
+        squirm_jit_emit_cold_jcc(
+            ctx,
+            SQUIRM_JIT_CC_NZ,
+            (squirm_jit_cold_t){ .kind = SQUIRM_JIT_COLD_SMC, .remaining = remaining }
+        );
+    }
+}
+
+static void squirm_jit_emit_op(squirm_jit_ctx_t* ctx, squirm_op_t op, u16 ip, u32 remaining) {
+    squirm_jit_t* jit = ctx->jit;
+    u16 next = ip + 4;
+
+    switch (op.op) {
+        case BURROW_OP_NOP:
+            break;
+        case BURROW_OP_LDI:
+            // mov word [rbx + dest], imm
+            SQUIRM_JIT_EMIT(jit, 0x66, 0xc7, 0x43, SQUIRM_JIT_REG(op.args.dest));
+            squirm_jit_emit16(jit, op.imm);
+
+            if (op.args.dest == BURROW_REG_FL) {
+                squirm_jit_emit_load_flags(jit);
+            }
+            break;
+        case BURROW_OP_LDR:
+        case BURROW_OP_LDRB:
+        case BURROW_OP_STI:
+        case BURROW_OP_STIB:
+        case BURROW_OP_STR:
+        case BURROW_OP_STRB:
+            squirm_jit_emit_mem(ctx, op, next, remaining);
+            break;
+        case BURROW_OP_JMP:
+            squirm_jit_emit_link(ctx, op.imm);
+            return;
+        case BURROW_OP_JZ: {
+            // test r14b, ZERO
+            SQUIRM_JIT_EMIT(jit, 0x41, 0xf6, 0xc6, BURROW_FL_ZERO);
+            // jz not_taken
+            SQUIRM_JIT_EMIT(jit, 0x0f, SQUIRM_JIT_CC_Z);
+            usize not_taken = squirm_jit_emit_rel32(jit);
+            // and r14d, ~ZERO
+            SQUIRM_JIT_EMIT(jit, 0x41, 0x83, 0xe6, 0xfe);
+            squirm_jit_emit_link(ctx, op.imm);
+            squirm_jit_patch_rel32(jit, not_taken, jit->code + jit->code_len);
+            squirm_jit_emit_link(ctx, next);
+            return;
+        }
+        case BURROW_OP_JD:
+            if (op.args.dest == BURROW_REG_IP) {
+                squirm_jit_emit_set_ip(jit, next);
+            } else if (op.args.dest == BURROW_REG_FL) {
+                squirm_jit_emit_store_flags(jit);
+            }
+
+            // movzx eax, word [rbx + dest]; mov [rbx + IP], ax
+            SQUIRM_JIT_EMIT(jit, 0x0f, 0xb7, 0x43, SQUIRM_JIT_REG(op.args.dest));
+            SQUIRM_JIT_EMIT(jit, 0x66, 0x89, 0x43, SQUIRM_JIT_IP);
+            // test al, 3; jnz dispatch
+            SQUIRM_JIT_EMIT(jit, 0xa8, 0x03, 0x0f, SQUIRM_JIT_CC_NZ);
+            squirm_jit_patch_rel32(jit, squirm_jit_emit_rel32(jit), jit->exit_dispatch);
+            // cmp eax, CODE_END; ja dispatch
+            SQUIRM_JIT_EMIT(jit, 0x3d);
+            squirm_jit_emit32(jit, BURROW_MEM_CODE_END);
+            SQUIRM_JIT_EMIT(jit, 0x0f, 0x87);
+            squirm_jit_patch_rel32(jit, squirm_jit_emit_rel32(jit), jit->exit_dispatch);
+            // mov rcx, native; mov rcx, [rcx + rax * 2]; test rcx, rcx; jz dispatch; jmp rcx
+            SQUIRM_JIT_EMIT(jit, 0x48, 0xb9);
+            squirm_jit_emit64(jit, (u64)(uintptr_t)jit->native);
+            SQUIRM_JIT_EMIT(jit, 0x48, 0x8b, 0x0c, 0x41);
+            SQUIRM_JIT_EMIT(jit, 0x48, 0x85, 0xc9, 0x0f, SQUIRM_JIT_CC_Z);
+            squirm_jit_patch_rel32(jit, squirm_jit_emit_rel32(jit), jit->exit_dispatch);
+            SQUIRM_JIT_EMIT(jit, 0xff, 0xe1);
+            return;
+        default:
+            squirm_jit_emit_alu(ctx, op, next, remaining);
+            break;
+    }
+
+    if (squirm_jit_ends_block(op)) {
+        // the op wrote %ip, or %fl and the run loop checks for FIN
+        if (op.args.dest == BURROW_REG_FL) {
+            squirm_jit_emit_set_ip(jit, next);
+        }
+
+        squirm_jit_emit_jmp(jit, jit->exit_dispatch);
+    }
+}
+
+// translates the block at `ip`. returns NULL if its first instruction can't be translated.
+static u8* squirm_jit_compile(squirm_jit_t* jit, u16 ip) {
+    squirm_cpu_t* cpu = jit->cpu;
+
+    if (SQUIRM_JIT_CODE_SIZE - jit->code_len < SQUIRM_JIT_MAX_BLOCK_SIZE) {
+        LOG_DEBUG("jit code buffer full, flushing\n");
+        squirm_jit_flush(jit);
+    }
+
+    squirm_jit_block_t* block = &jit->blocks[ip / 4];
+    u8* stale_entry = block->valid ? block->entry : NULL;
+    u16 page = ip / SQUIRM_CODE_PAGE_SIZE;
+
+    squirm_op_t ops[SQUIRM_JIT_MAX_BLOCK_OPS];
+    u32 len = 0;
+    bool terminated = false;
+    u16 at = ip;
+
+    while (len < SQUIRM_JIT_MAX_BLOCK_OPS) {
+        squirm_op_t op = squirm_jit_decode(cpu, at);
+
+        if (!squirm_jit_can_translate(op)) {
+            break;
+        }
+
+        ops[len++] = op;
+        at += 4;
+
+        if (squirm_jit_ends_block(op)) {
+            terminated = true;
+            break;
+        }
+
+        // blocks never span code pages, so a page write only affects its own blocks
+        if (at % SQUIRM_CODE_PAGE_SIZE == 0) {
+            break;
+        }
+    }
+
+    block->valid = true;
+    block->gen = cpu->code_page_gen[page];
+    block->entry = NULL;
+    jit->native[ip / 4] = NULL;
+
+    if (len == 0) {
+        return NULL;
+    }
+
+    squirm_jit_ctx_t ctx = {
+        .jit = jit,
+        .start = ip,
+        .len = len,
+        .gen = block->gen,
+        .gen_offset = (u32)(offsetof(squirm_cpu_t, code_page_gen) + page * sizeof(u32)),
+        .cold_len = 0,
+    };
+
+    u8* entry = jit->code + jit->code_len;
+
+    // set up front, so loops back to the block start link directly
+    block->entry = entry;
+    jit->native[ip / 4] = entry;
+
+    squirm_jit_emit_gen_check(&ctx);
+    squirm_jit_emit_cold_jcc(
+        &ctx,
+        SQUIRM_JIT_CC_NZ,
+        (squirm_jit_cold_t){ .kind = SQUIRM_JIT_COLD_STALE }
+    );
+
+    // sub r12, len
+    SQUIRM_JIT_EMIT(jit, 0x49, 0x81, 0xec);
+    squirm_jit_emit32(jit, len);
+    squirm_jit_emit_cold_jcc(
+        &ctx,
+        SQUIRM_JIT_CC_B,
+        (squirm_jit_cold_t){ .kind = SQUIRM_JIT_COLD_BUDGET }
+    );
+
+    for (u32 i = 0; i < len; i++) {
+        squirm_jit_emit_op(&ctx, ops[i], (u16)(ip + i * 4), len - i - 1);
+    }
+
+    if (!terminated) {
+        squirm_jit_emit_link(&ctx, at);
+    }
+
+    squirm_jit_emit_cold(&ctx);
+
+    squirm_jit_resolve_links(jit, ip, entry);
+
+    if (stale_entry != NULL) {
+        // blocks chained to the old translation continue in the new one
+        usize code_len = jit->code_len;
+        jit->code_len = (usize)(stale_entry - jit->code);
+        squirm_jit_emit_jmp(jit, entry);
+        jit->code_len = code_len;
+    }
+
+    return entry;
+}
+
+static inline u8* squirm_jit_lookup(squirm_jit_t* jit, u16 ip) {
+    if (ip % 4 != 0 || ip > BURROW_MEM_CODE_END) {
+        return NULL;
+    }
+
+    if (squirm_jit_block_fresh(jit, ip)) {
+        return jit->blocks[ip / 4].entry;
+    }
+
+    return squirm_jit_compile(jit, ip);
+}
+
+squirm_cpu_exit_t squirm_jit_run(squirm_jit_t* jit, usize max_ops) {
+    squirm_cpu_t* cpu = jit->cpu;
+    usize remaining = max_ops;
+
+    cpu->mmio_accessed = false;
+
+    while (remaining > 0) {
+        // translated code leaves its block after every write to %fl
+        if (cpu->reg[BURROW_REG_FL] & BURROW_FL_FIN) {
+            return SQUIRM_CPU_EXIT_FIN;
+        }
+
+        u8* entry = squirm_jit_lookup(jit, cpu->reg[BURROW_REG_IP]);
+
+        if (entry == NULL) {
+            // not translatable, let the interpreter run it
+            usize executed = cpu->executed_op_count;
+            squirm_cpu_exit_t result = squirm_cpu_run(cpu, 1);
+            remaining -= cpu->executed_op_count - executed;
+
+            if (result != SQUIRM_CPU_EXIT_BUDGET) {
+                return result;
+            }
+
+            continue;
+        }
+
+        // generated code computes flags eagerly, so it needs %fl up to date
+        squirm_cpu_sync_flags(cpu);
+
+        usize budget = remaining;
+        u32 result = jit->enter(cpu, entry, &budget);
+
+        cpu->executed_op_count += remaining - budget;
+        remaining = budget;
+
+        if (result == SQUIRM_CPU_EXIT_MMIO) {
+            cpu->mmio_accessed = false;
+            return SQUIRM_CPU_EXIT_MMIO;
+        }
+
+        if (result == SQUIRM_CPU_EXIT_BUDGET) {
+            // the next block doesn't fit in what's left, finish up in the interpreter
+            return remaining > 0 ? squirm_cpu_run(cpu, remaining) : SQUIRM_CPU_EXIT_BUDGET;
+        }
+    }
+
+    return SQUIRM_CPU_EXIT_BUDGET;
+}
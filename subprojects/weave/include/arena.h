@@ -0,0 +1,25 @@
+#pragma once
+
+#include "types.h"
+
+// size of the blocks an arena allocates from, larger allocations get a block of their own
+#define WEAVE_ARENA_BLOCK_SIZE 0x10000
+
+typedef struct weave_arena_block {
+    struct weave_arena_block* prev;
+    usize size;
+    usize used;
+} weave_arena_block_t;
+
+// a bump allocator. memory is only released all at once, by `weave_arena_free`.
+typedef struct weave_arena {
+    weave_arena_block_t* block; // the block allocations are taken from, NULL until the first
+    void* last;                 // the most recent allocation, which can grow in place
+} weave_arena_t;
+
+weave_arena_t* weave_arena_new(void);
+void weave_arena_free(weave_arena_t* arena);
+
+void* weave_arena_alloc(weave_arena_t* arena, usize size);
+void* weave_arena_grow(weave_arena_t* arena, void* ptr, usize old_size, usize new_size);
+char* weave_arena_strndup(weave_arena_t* arena, const char* str, usize len);
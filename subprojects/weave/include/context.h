@@ -0,0 +1,36 @@
+#pragma once
+
+#include "arena.h"
+#include "types.h"
+
+#include <setjmp.h>
+
+// longest message a diagnostic keeps, the rest is cut off
+#define WEAVE_DIAGNOSTIC_MESSAGE_SIZE 256
+
+typedef struct weave_diagnostic {
+    u32 line; // 0 if it isn't about a position in the source
+    u32 col;
+    char message[WEAVE_DIAGNOSTIC_MESSAGE_SIZE];
+} weave_diagnostic_t;
+
+// state shared by the lexer, preprocessor and assembler while assembling a program. all of
+// their memory comes from `arena`, and is released in one go with the context.
+typedef struct weave_context {
+    weave_arena_t* arena;
+
+    // errors reported so far, in the order they were found
+    weave_diagnostic_t* diagnostics;
+    usize diagnostic_count;
+    usize diagnostic_cap;
+
+    // set up by whoever runs the stages, an error that stops assembly jumps back here
+    jmp_buf abort;
+} weave_context_t;
+
+weave_context_t* weave_context_new(void);
+void weave_context_free(weave_context_t* context);
+
+void weave_context_report(weave_context_t* context, u32 line, u32 col, const char* fmt, ...);
+_Noreturn void
+weave_context_abort(weave_context_t* context, u32 line, u32 col, const char* fmt, ...);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "types.h"
+
+// FNV-1a, used to index labels and macros by name
+static inline u32 weave_hash_str(const char* str, usize len) {
+    u32 hash = 0x811c9dc5;
+
+    for (usize i = 0; i < len; i++) {
+        hash = (hash ^ (u8)str[i]) * 0x01000193;
+    }
+
+    return hash;
+}
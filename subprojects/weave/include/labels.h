@@ -0,0 +1,36 @@
+#pragma once
+
+#include "context.h"
+#include "types.h"
+
+typedef struct weave_label {
+    const char* name;
+    u16 name_len;
+    u32 hash;
+    u16 addr;
+    bool defined;
+
+    u16* unresolved_refs;
+    usize unresolved_refs_len;
+    usize unresolved_refs_cap;
+} weave_label_t;
+
+// labels in the order they were first seen, indexed by an open-addressing hash table of
+// their names. everything is allocated from the arena of the context.
+typedef struct weave_labels {
+    weave_context_t* context;
+
+    weave_label_t* labels;
+    usize len;
+    usize cap;
+
+    // index of a label plus one, 0 for an empty slot. linear probing, the slot count is a
+    // power of two and kept at least twice the label count.
+    u32* slots;
+    usize slot_cap;
+} weave_labels_t;
+
+weave_labels_t* weave_labels_new(weave_context_t* context);
+
+weave_label_t* weave_labels_get(weave_labels_t* labels, const char* name, u16 name_len);
+void weave_label_add_ref(weave_labels_t* labels, weave_label_t* label, u16 addr);
@@ -1,9 +1,8 @@
 #pragma once
+#include "context.h"
 #include "result.h"
 #include "types.h"
 
-#include <stdio.h>
-
 typedef enum weave_token_ty {
     WEAVE_TOKEN_INVALID,
     WEAVE_TOKEN_EOF,
@@ -30,6 +29,8 @@ typedef enum weave_token_ty {
 
 const char* weave_token_ty_str(weave_token_ty_t ty);
 
+// strings of tokens live in the arena of the context they were lexed in, so tokens are
+// plain values that can be copied freely
 typedef union weave_token_val {
     i32 int_val;
     struct {
@@ -50,15 +51,20 @@ typedef struct weave_token {
     weave_token_pos_t pos;
 } weave_token_t;
 
-void weave_token_free(weave_token_t* token);
-weave_token_t weave_token_clone(weave_token_t* token);
+// longest identifier or string the lexer accepts
+#define WEAVE_LEXER_BUFFER_SIZE 1024
 
 typedef struct weave_lexer {
-    FILE* input; // read stream
-    usize pos;   // current position in the stream
+    weave_context_t* context;
+    const char* src; // the whole source, not owned by the lexer
+    usize len;
+    usize pos; // current position in the source
     u32 line;
     u32 col;
-    char c; // current character
+    char c; // current character, '\0' past the end of the source
+
+    // identifiers and strings are read into here, then copied into the arena
+    char buffer[WEAVE_LEXER_BUFFER_SIZE];
 } weave_lexer_t;
 
 typedef enum weave_lexer_error {
@@ -81,7 +87,6 @@ const char* weave_lexer_error_str(weave_lexer_error_t error);
 
 typedef RESULT_TYPE(weave_token_t, weave_lexer_error_t) weave_lexer_result_t;
 
-weave_lexer_t* weave_lexer_new(FILE* input);
-void weave_lexer_free(weave_lexer_t* lexer);
+weave_lexer_t* weave_lexer_new(weave_context_t* context, const char* src, usize len);
 
 weave_lexer_result_t weave_lexer_next(weave_lexer_t* lexer);
@@ -4,33 +4,47 @@
 #include "types.h"
 #include "result.h"
 
+#define WEAVE_MACRO_NO_ARG ((usize)-1)
+
+// a token of a macro body. `$arg` references are resolved to the index of the argument when
+// the macro is defined, so expanding it only copies tokens.
+typedef struct weave_macro_token {
+    weave_token_t token; // unused for argument references
+    usize arg;           // index of the argument this expands to, or WEAVE_MACRO_NO_ARG
+} weave_macro_token_t;
+
 typedef struct weave_macro {
+    char* name;
+    u32 hash;
     usize len_args;
     usize cap_args;
     char** arg_names;
     usize len_tokens;
     usize cap_tokens;
-    weave_token_t* tokens;
+    weave_macro_token_t* tokens;
 } weave_macro_t;
 
-void weave_macro_free(weave_macro_t* macro);
-
 typedef struct weave_preprocessor {
+    weave_context_t* context;
     weave_lexer_t* lexer;
     weave_token_pos_t macro_start_pos;
     weave_token_t current_lexer_token;
-    char** macro_names;
+    // macros in definition order, indexed by an open-addressing hash table of their names
     weave_macro_t** macros;
     usize num_macros;
     usize cap_macros;
+    u32* macro_slots; // index of a macro plus one, 0 for an empty slot
+    usize macro_slot_cap;
 
     weave_macro_t* current_macro;
+    // the arguments of the current invocation. kept between invocations, so their buffers
+    // are reused.
     struct {
         weave_token_t* arg_tokens;
         usize arg_token_len;
         usize arg_token_cap;
     }* current_macro_args;
-    usize current_macro_arg_count;
+    usize current_macro_args_cap;
     usize current_macro_token_index;
     usize current_macro_arg_index;
     usize current_macro_arg_expansion_index;
@@ -48,6 +62,5 @@ typedef enum weave_preprocessor_error {
 
 const char* weave_preprocessor_error_str(weave_preprocessor_error_t error);
 
-weave_preprocessor_t* weave_preprocessor_new(weave_lexer_t* lexer);
-void weave_preprocessor_free(weave_preprocessor_t* preprocessor);
+weave_preprocessor_t* weave_preprocessor_new(weave_context_t* context, weave_lexer_t* lexer);
 weave_token_t weave_preprocessor_next(weave_preprocessor_t* preprocessor);
@@ -2,6 +2,8 @@
 
 #include <stdio.h>
 #include "burrow.h"
+#include "context.h"
+#include "labels.h"
 #include "lexer.h"
 #include "preprocessor.h"
 #include "types.h"
@@ -15,32 +17,46 @@ typedef struct burrow_op {
     } regs;
 } burrow_op_t;
 
-typedef struct weave_label {
-    char* name;
-    u16 addr;
-    bool defined;
-
-    u16* unresolved_refs;
-    usize unresolved_refs_len;
-    usize unresolved_refs_cap;
-} weave_label_t;
-
-#define WEAVE_MAX_LABELS 256
-
 typedef struct weave {
-    FILE* output;
+    weave_context_t* context;
     weave_preprocessor_t* preprocessor;
 
     // state
     weave_token_t token;
     u16 addr;
 
-    // labels
-    // TODO: use a hash table
-    weave_label_t labels[WEAVE_MAX_LABELS];
-    u16 num_labels;
+    weave_labels_t* labels;
+
+    // the assembled program. label references are patched in here once the whole input is
+    // assembled.
+    u8* image;
+    usize image_len;
+    usize image_cap;
 
     bool at_eof;
 } weave_t;
 
+typedef struct weave_symbol {
+    const char* name;
+    u16 addr;
+} weave_symbol_t;
+
+// what assembling a program produced. all of it is owned by the result, and released with
+// `weave_result_free`.
+typedef struct weave_result {
+    bool ok; // no errors were reported, `image` is the whole program
+
+    u8* image; // NULL if an error stopped assembly
+    usize image_len;
+
+    weave_symbol_t* symbols; // the defined labels, in the order they were first seen
+    usize symbol_count;
+
+    weave_diagnostic_t* diagnostics;
+    usize diagnostic_count;
+} weave_result_t;
+
+bool weave_assemble_buffer(const char* src, usize len, weave_result_t* out);
+void weave_result_free(weave_result_t* result);
+
 void weave_process(FILE* input, FILE* output);
@@ -0,0 +1,110 @@
+#include "arena.h"
+
+#include "log.h"
+#include "types.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WEAVE_ARENA_ALIGN _Alignof(max_align_t)
+#define WEAVE_ARENA_ALIGN_UP(size) (((size) + WEAVE_ARENA_ALIGN - 1) & ~(WEAVE_ARENA_ALIGN - 1))
+
+// allocations start after the block header
+#define WEAVE_ARENA_HEADER_SIZE WEAVE_ARENA_ALIGN_UP(sizeof(weave_arena_block_t))
+
+weave_arena_t* weave_arena_new(void) {
+    weave_arena_t* arena = malloc(sizeof(weave_arena_t));
+
+    if (arena == NULL) {
+        LOG_ERROR("internal error: Failed to allocate memory for arena\n");
+        exit(1);
+    }
+
+    arena->block = NULL;
+    arena->last = NULL;
+
+    return arena;
+}
+
+void weave_arena_free(weave_arena_t* arena) {
+    weave_arena_block_t* block = arena->block;
+
+    while (block != NULL) {
+        weave_arena_block_t* prev = block->prev;
+        free(block);
+        block = prev;
+    }
+
+    free(arena);
+}
+
+static u8* weave_arena_block_data(weave_arena_block_t* block) {
+    return (u8*)block + WEAVE_ARENA_HEADER_SIZE;
+}
+
+void* weave_arena_alloc(weave_arena_t* arena, usize size) {
+    size = WEAVE_ARENA_ALIGN_UP(size);
+
+    weave_arena_block_t* block = arena->block;
+
+    if (block == NULL || block->size - block->used < size) {
+        usize block_size = size > WEAVE_ARENA_BLOCK_SIZE ? size : WEAVE_ARENA_BLOCK_SIZE;
+
+        block = malloc(WEAVE_ARENA_HEADER_SIZE + block_size);
+
+        if (block == NULL) {
+            LOG_ERROR("internal error: Failed to allocate memory for arena\n");
+            exit(1);
+        }
+
+        block->size = block_size;
+        block->used = 0;
+
+        // an oversized block is full right away, so keep filling the current one
+        if (arena->block != NULL && block_size > WEAVE_ARENA_BLOCK_SIZE) {
+            block->prev = arena->block->prev;
+            arena->block->prev = block;
+        } else {
+            block->prev = arena->block;
+            arena->block = block;
+        }
+    }
+
+    void* ptr = weave_arena_block_data(block) + block->used;
+    block->used += size;
+    arena->last = block == arena->block ? ptr : NULL;
+
+    return ptr;
+}
+
+// like `realloc`. the most recent allocation is grown in place if its block has room left.
+void* weave_arena_grow(weave_arena_t* arena, void* ptr, usize old_size, usize new_size) {
+    weave_arena_block_t* block = arena->block;
+
+    if (ptr != NULL && ptr == arena->last) {
+        usize offset = (usize)((u8*)ptr - weave_arena_block_data(block));
+
+        if (offset < block->size && block->size - offset >= new_size) {
+            block->used = offset + WEAVE_ARENA_ALIGN_UP(new_size);
+            return ptr;
+        }
+    }
+
+    void* new_ptr = weave_arena_alloc(arena, new_size);
+
+    if (ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    }
+
+    return new_ptr;
+}
+
+char* weave_arena_strndup(weave_arena_t* arena, const char* str, usize len) {
+    char* copy = weave_arena_alloc(arena, len + 1);
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    return copy;
+}
@@ -0,0 +1,80 @@
+#include "context.h"
+
+#include "arena.h"
+#include "log.h"
+#include "types.h"
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WEAVE_CONTEXT_INITIAL_DIAGNOSTIC_CAP 8
+
+weave_context_t* weave_context_new(void) {
+    weave_context_t* context = malloc(sizeof(weave_context_t));
+
+    if (context == NULL) {
+        LOG_ERROR("internal error: Failed to allocate memory for context\n");
+        exit(1);
+    }
+
+    context->arena = weave_arena_new();
+
+    context->diagnostics = NULL;
+    context->diagnostic_count = 0;
+    context->diagnostic_cap = 0;
+
+    return context;
+}
+
+void weave_context_free(weave_context_t* context) {
+    weave_arena_free(context->arena);
+    free(context);
+}
+
+static void weave_context_add_diagnostic(
+    weave_context_t* context,
+    u32 line,
+    u32 col,
+    const char* fmt,
+    va_list args
+) {
+    if (context->diagnostic_count == context->diagnostic_cap) {
+        usize cap = context->diagnostic_cap == 0 ? WEAVE_CONTEXT_INITIAL_DIAGNOSTIC_CAP
+                                                 : context->diagnostic_cap * 2;
+
+        context->diagnostics = weave_arena_grow(
+            context->arena,
+            context->diagnostics,
+            sizeof(weave_diagnostic_t) * context->diagnostic_cap,
+            sizeof(weave_diagnostic_t) * cap
+        );
+        context->diagnostic_cap = cap;
+    }
+
+    weave_diagnostic_t* diagnostic = &context->diagnostics[context->diagnostic_count++];
+
+    diagnostic->line = line;
+    diagnostic->col = col;
+    vsnprintf(diagnostic->message, sizeof(diagnostic->message), fmt, args);
+}
+
+// records an error, and carries on assembling
+void weave_context_report(weave_context_t* context, u32 line, u32 col, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    weave_context_add_diagnostic(context, line, col, fmt, args);
+    va_end(args);
+}
+
+// records an error, and stops assembling by jumping back to `context->abort`
+_Noreturn void
+weave_context_abort(weave_context_t* context, u32 line, u32 col, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    weave_context_add_diagnostic(context, line, col, fmt, args);
+    va_end(args);
+
+    longjmp(context->abort, 1);
+}
@@ -0,0 +1,114 @@
+#include "labels.h"
+
+#include "arena.h"
+#include "context.h"
+#include "hash.h"
+#include "types.h"
+
+#include <string.h>
+
+#define WEAVE_LABELS_INITIAL_CAP 64
+
+weave_labels_t* weave_labels_new(weave_context_t* context) {
+    weave_arena_t* arena = context->arena;
+    weave_labels_t* labels = weave_arena_alloc(arena, sizeof(weave_labels_t));
+
+    labels->context = context;
+
+    labels->len = 0;
+    labels->cap = WEAVE_LABELS_INITIAL_CAP;
+    labels->labels = weave_arena_alloc(arena, sizeof(weave_label_t) * labels->cap);
+
+    labels->slot_cap = WEAVE_LABELS_INITIAL_CAP * 2;
+    labels->slots = weave_arena_alloc(arena, sizeof(u32) * labels->slot_cap);
+    memset(labels->slots, 0, sizeof(u32) * labels->slot_cap);
+
+    return labels;
+}
+
+// doubles the slot table and re-inserts every label, reusing the hashes they were stored
+// with
+static void weave_labels_grow_slots(weave_labels_t* labels) {
+    usize slot_cap = labels->slot_cap * 2;
+    u32* slots = weave_arena_alloc(labels->context->arena, sizeof(u32) * slot_cap);
+
+    memset(slots, 0, sizeof(u32) * slot_cap);
+
+    for (usize i = 0; i < labels->len; i++) {
+        usize slot = labels->labels[i].hash & (slot_cap - 1);
+
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (slot_cap - 1);
+        }
+
+        slots[slot] = (u32)(i + 1);
+    }
+
+    labels->slots = slots;
+    labels->slot_cap = slot_cap;
+}
+
+// returns the label with the given name, adding it as undefined if it hasn't been seen yet.
+// the label is only valid until the next label is added.
+weave_label_t* weave_labels_get(weave_labels_t* labels, const char* name, u16 name_len) {
+    weave_arena_t* arena = labels->context->arena;
+    u32 hash = weave_hash_str(name, name_len);
+    usize slot = hash & (labels->slot_cap - 1);
+
+    while (labels->slots[slot] != 0) {
+        weave_label_t* label = &labels->labels[labels->slots[slot] - 1];
+
+        if (label->hash == hash && label->name_len == name_len &&
+            memcmp(label->name, name, name_len) == 0) {
+            return label;
+        }
+
+        slot = (slot + 1) & (labels->slot_cap - 1);
+    }
+
+    if (labels->len == labels->cap) {
+        labels->labels = weave_arena_grow(
+            arena,
+            labels->labels,
+            sizeof(weave_label_t) * labels->cap,
+            sizeof(weave_label_t) * labels->cap * 2
+        );
+        labels->cap *= 2;
+    }
+
+    weave_label_t* label = &labels->labels[labels->len++];
+
+    label->name = weave_arena_strndup(arena, name, name_len);
+    label->name_len = name_len;
+    label->hash = hash;
+    label->addr = 0;
+    label->defined = false;
+    label->unresolved_refs = NULL;
+    label->unresolved_refs_len = 0;
+    label->unresolved_refs_cap = 0;
+
+    labels->slots[slot] = (u32)labels->len;
+
+    if (labels->len * 2 > labels->slot_cap) {
+        weave_labels_grow_slots(labels);
+    }
+
+    return label;
+}
+
+// records a reference to a label that isn't defined yet, to be patched with its address
+void weave_label_add_ref(weave_labels_t* labels, weave_label_t* label, u16 addr) {
+    if (label->unresolved_refs_len == label->unresolved_refs_cap) {
+        usize cap = label->unresolved_refs_cap == 0 ? 4 : label->unresolved_refs_cap * 2;
+
+        label->unresolved_refs = weave_arena_grow(
+            labels->context->arena,
+            label->unresolved_refs,
+            sizeof(u16) * label->unresolved_refs_cap,
+            sizeof(u16) * cap
+        );
+        label->unresolved_refs_cap = cap;
+    }
+
+    label->unresolved_refs[label->unresolved_refs_len++] = addr;
+}
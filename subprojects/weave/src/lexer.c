@@ -1,28 +1,10 @@
 #include "lexer.h"
 
+#include "arena.h"
+#include "context.h"
 #include "types.h"
-#include <stdlib.h>
 #include <string.h>
 
-#ifdef _WIN32
-char* strndup(const char* s, size_t n) {
-    char* result;
-    size_t len = strlen(s);
-
-    if (n < len) {
-        len = n;
-    }
-
-    result = malloc(len + 1);
-    if (!result) {
-        return 0;
-    }
-
-    result[len] = '\0';
-    return (char*)memcpy(result, s, len);
-}
-#endif
-
 const char* weave_token_ty_str(weave_token_ty_t ty) {
     switch (ty) {
         case WEAVE_TOKEN_INVALID:
@@ -95,52 +77,31 @@ const char* weave_lexer_error_str(weave_lexer_error_t error) {
     }
 }
 
-void weave_token_free(weave_token_t* token) {
-    if (token->ty == WEAVE_TOKEN_IDENTIFIER || token->ty == WEAVE_TOKEN_STR) {
-        free(token->val.str_val.val);
-    }
-}
-
-weave_token_t weave_token_clone(weave_token_t *token) {
-    if (token->ty == WEAVE_TOKEN_IDENTIFIER || token->ty == WEAVE_TOKEN_STR) {
-        return (weave_token_t) {
-            .ty = token->ty,
-            .val = {
-                .str_val = {
-                    .val = strndup(token->val.str_val.val, token->val.str_val.len),
-                    .len = token->val.str_val.len
-                }
-            }
-        };
-    } else {
-        return *token;
-    }
-}
+weave_lexer_t* weave_lexer_new(weave_context_t* context, const char* src, usize len) {
+    weave_lexer_t* lexer = weave_arena_alloc(context->arena, sizeof(weave_lexer_t));
 
-weave_lexer_t* weave_lexer_new(FILE* input) {
-    weave_lexer_t* lexer = malloc(sizeof(weave_lexer_t));
-
-    lexer->input = input;
+    lexer->context = context;
+    lexer->src = src;
+    lexer->len = len;
     lexer->line = 1;
     lexer->col = 1;
     lexer->pos = 0;
-    lexer->c = fgetc(input);
+    lexer->c = len > 0 ? src[0] : '\0';
 
     return lexer;
 }
 
-void weave_lexer_free(weave_lexer_t* lexer) {
-    free(lexer);
-}
-
 static void weave_lexer_advance(weave_lexer_t* lexer) {
     if (lexer->c == '\n') {
         lexer->line++;
         lexer->col = 0;
     }
 
-    lexer->c = fgetc(lexer->input);
-    lexer->pos++;
+    if (lexer->pos < lexer->len) {
+        lexer->pos++;
+    }
+
+    lexer->c = lexer->pos < lexer->len ? lexer->src[lexer->pos] : '\0';
     lexer->col++;
 }
 
@@ -150,7 +111,7 @@ static void weave_lexer_skip_meaningless_whitespace(weave_lexer_t* lexer) {
     }
 
     if (lexer->c == '#') {
-        while (lexer->c != '\n') {
+        while (lexer->c != '\n' && lexer->c != '\0') {
             weave_lexer_advance(lexer);
         }
     }
@@ -164,12 +125,12 @@ static weave_lexer_result_t weave_lexer_parse_string(weave_lexer_t* lexer) {
 
     weave_lexer_advance(lexer);
 
-    char* buffer = malloc(1024);
-    size_t buffer_size = 1024;
+    char* buffer = lexer->buffer;
+    size_t buffer_size = WEAVE_LEXER_BUFFER_SIZE;
     size_t buffer_pos = 0;
 
     while (lexer->c != '"') {
-        if (lexer->c == EOF) {
+        if (lexer->c == '\0') {
             weave_lexer_result_t result;
             result.is_ok = false;
             result.err = WEAVE_LEXER_ERROR_UNTERMINATED_STRING;
@@ -213,7 +174,7 @@ static weave_lexer_result_t weave_lexer_parse_string(weave_lexer_t* lexer) {
         weave_lexer_advance(lexer);
     }
 
-    token.val.str_val.val = buffer;
+    token.val.str_val.val = weave_arena_strndup(lexer->context->arena, buffer, buffer_pos);
     token.val.str_val.len = buffer_pos;
 
     weave_lexer_advance(lexer);
@@ -405,8 +366,9 @@ static weave_lexer_result_t weave_lexer_parse_identifier(weave_lexer_t* lexer) {
     token.pos.line = lexer->line;
     token.pos.col = lexer->col;
 
-    char* buffer = malloc(1024);
-    size_t buffer_size = 1024;
+    char* buffer = lexer->buffer;
+    // leaves room for the terminator
+    size_t buffer_size = WEAVE_LEXER_BUFFER_SIZE - 1;
     size_t buffer_pos = 0;
 
     // first char must be [a-zA-Z_]
@@ -439,7 +401,7 @@ static weave_lexer_result_t weave_lexer_parse_identifier(weave_lexer_t* lexer) {
 
     if (token.ty == WEAVE_TOKEN_INVALID) {
         token.ty = WEAVE_TOKEN_IDENTIFIER;
-        token.val.str_val.val = buffer;
+        token.val.str_val.val = weave_arena_strndup(lexer->context->arena, buffer, buffer_pos);
         token.val.str_val.len = buffer_pos;
 
         weave_lexer_result_t result;
@@ -447,7 +409,6 @@ static weave_lexer_result_t weave_lexer_parse_identifier(weave_lexer_t* lexer) {
         result.ok = token;
         return result;
     } else {
-        free(buffer);
         weave_lexer_result_t result;
         result.is_ok = true;
         result.ok = token;
@@ -511,7 +472,7 @@ weave_lexer_result_t weave_lexer_next(weave_lexer_t* lexer) {
 
     weave_lexer_result_t result;
 
-    if (lexer->c == '\0' || lexer->c == EOF) {
+    if (lexer->c == '\0') {
         weave_token_t token;
         token.ty = WEAVE_TOKEN_EOF;
         token.pos.line = lexer->line;
@@ -72,7 +72,7 @@ int main(int argc, char* argv[]) {
     if (args.output_file == NULL || strcmp(args.output_file, "-") == 0) {
         output_file = stdout;
     } else {
-        output_file = fopen(args.output_file, "w");
+        output_file = fopen(args.output_file, "wb");
 
         if (output_file == NULL) {
             LOG_ERROR("Failed to open output file: %s\n", args.output_file);
@@ -1,11 +1,11 @@
 #include "preprocessor.h"
 
+#include "arena.h"
+#include "context.h"
+#include "hash.h"
 #include "lexer.h"
-#include "log.h"
 #include "types.h"
 
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
 const char* weave_preprocessor_error_str(weave_preprocessor_error_t error) {
@@ -23,29 +23,27 @@ const char* weave_preprocessor_error_str(weave_preprocessor_error_t error) {
     return "Unknown error";
 }
 
-void weave_macro_free(weave_macro_t* macro) {
-    for (usize i = 0; i < macro->len_tokens; i++) {
-        weave_token_free(&macro->tokens[i]);
-    }
-    for (usize i = 0; i < macro->len_args; i++) {
-        free(macro->arg_names[i]);
-    }
-    free(macro->tokens);
-    free(macro->arg_names);
-    free(macro);
-}
+#define WEAVE_PREPROCESSOR_INITIAL_MACRO_CAP 8
 
-weave_preprocessor_t* weave_preprocessor_new(weave_lexer_t* lexer) {
-    weave_preprocessor_t* preprocessor = malloc(sizeof(weave_preprocessor_t));
+weave_preprocessor_t* weave_preprocessor_new(weave_context_t* context, weave_lexer_t* lexer) {
+    weave_arena_t* arena = context->arena;
+    weave_preprocessor_t* preprocessor = weave_arena_alloc(arena, sizeof(weave_preprocessor_t));
+    preprocessor->context = context;
     preprocessor->lexer = lexer;
     preprocessor->at_eof = false;
 
-    preprocessor->macro_names = malloc(sizeof(char*) * 8);
-    preprocessor->macros = malloc(sizeof(weave_macro_t*) * 8);
     preprocessor->num_macros = 0;
-    preprocessor->cap_macros = 8;
+    preprocessor->cap_macros = WEAVE_PREPROCESSOR_INITIAL_MACRO_CAP;
+    preprocessor->macros =
+        weave_arena_alloc(arena, sizeof(weave_macro_t*) * preprocessor->cap_macros);
+    preprocessor->macro_slot_cap = WEAVE_PREPROCESSOR_INITIAL_MACRO_CAP * 2;
+    preprocessor->macro_slots =
+        weave_arena_alloc(arena, sizeof(u32) * preprocessor->macro_slot_cap);
+    memset(preprocessor->macro_slots, 0, sizeof(u32) * preprocessor->macro_slot_cap);
 
     preprocessor->current_macro = NULL;
+    preprocessor->current_macro_args = NULL;
+    preprocessor->current_macro_args_cap = 0;
     preprocessor->current_macro_arg_index = 0;
     preprocessor->current_macro_token_index = 0;
 
@@ -54,27 +52,16 @@ weave_preprocessor_t* weave_preprocessor_new(weave_lexer_t* lexer) {
     return preprocessor;
 }
 
-void weave_preprocessor_free(weave_preprocessor_t* preprocessor) {
-    for (usize i = 0; i < preprocessor->num_macros; i++) {
-        free(preprocessor->macro_names[i]);
-        weave_macro_free(preprocessor->macros[i]);
-    }
-    free(preprocessor->macro_names);
-    free(preprocessor->macros);
-    weave_lexer_free(preprocessor->lexer);
-    free(preprocessor);
-}
-
 void weave_preprocessor_advance(weave_preprocessor_t* preprocessor) {
     weave_lexer_result_t lexer_result = weave_lexer_next(preprocessor->lexer);
     if (!lexer_result.is_ok) {
-        LOG_ERROR(
-            "lexer error at %d:%d: %s",
+        weave_context_abort(
+            preprocessor->context,
             preprocessor->lexer->line,
             preprocessor->lexer->col,
+            "%s",
             weave_lexer_error_str(lexer_result.err)
         );
-        exit(1);
     }
 
     weave_token_t token = lexer_result.ok;
@@ -87,283 +74,291 @@ void weave_preprocessor_advance(weave_preprocessor_t* preprocessor) {
     }
 }
 
-static void weave_preprocessor_register_macro(weave_preprocessor_t* preprocessor) {
-    weave_lexer_result_t lexer_result = weave_lexer_next(preprocessor->lexer);
+// returns the slot of the macro with the given name, or the empty slot it would go in
+static usize weave_preprocessor_find_macro_slot(
+    const weave_preprocessor_t* preprocessor,
+    const char* name,
+    usize name_len,
+    u32 hash
+) {
+    usize slot = hash & (preprocessor->macro_slot_cap - 1);
+
+    while (preprocessor->macro_slots[slot] != 0) {
+        const weave_macro_t* macro = preprocessor->macros[preprocessor->macro_slots[slot] - 1];
+
+        if (macro->hash == hash && strncmp(macro->name, name, name_len) == 0 &&
+            macro->name[name_len] == '\0') {
+            return slot;
+        }
 
-    if (!lexer_result.is_ok) {
-        LOG_ERROR(
-            "lexer error registering macro at %d:%d: %s",
-            preprocessor->lexer->line,
-            preprocessor->lexer->col,
-            weave_lexer_error_str(lexer_result.err)
-        );
-        exit(1);
+        slot = (slot + 1) & (preprocessor->macro_slot_cap - 1);
     }
 
-    char* macro_name_raw = lexer_result.ok.val.str_val.val;
-    u16 macro_name_len = lexer_result.ok.val.str_val.len;
-
-    char* macro_name = malloc(sizeof(char) * (macro_name_len + 1));
-    memcpy(macro_name, macro_name_raw, macro_name_len);
-    macro_name[macro_name_len] = '\0';
+    return slot;
+}
 
-    weave_token_free(&lexer_result.ok);
+static weave_macro_t*
+weave_preprocessor_find_macro(weave_preprocessor_t* preprocessor, const char* name, usize len) {
+    usize slot =
+        weave_preprocessor_find_macro_slot(preprocessor, name, len, weave_hash_str(name, len));
 
-    for (usize i = 0; i < preprocessor->num_macros; i++) {
-        if (strcmp(preprocessor->macro_names[i], macro_name) == 0) {
-            LOG_ERROR(
-                "macro redefinition at %d:%d",
-                preprocessor->lexer->line,
-                preprocessor->lexer->col
-            );
-            exit(1);
-        }
+    if (preprocessor->macro_slots[slot] == 0) {
+        return NULL;
     }
 
+    return preprocessor->macros[preprocessor->macro_slots[slot] - 1];
+}
+
+static void
+weave_preprocessor_add_macro(weave_preprocessor_t* preprocessor, weave_macro_t* macro) {
+    weave_arena_t* arena = preprocessor->context->arena;
+
     if (preprocessor->num_macros == preprocessor->cap_macros) {
+        preprocessor->macros = weave_arena_grow(
+            arena,
+            preprocessor->macros,
+            sizeof(weave_macro_t*) * preprocessor->cap_macros,
+            sizeof(weave_macro_t*) * preprocessor->cap_macros * 2
+        );
         preprocessor->cap_macros *= 2;
-        preprocessor->macro_names =
-            realloc(preprocessor->macro_names, sizeof(char*) * preprocessor->cap_macros);
-        preprocessor->macros =
-            realloc(preprocessor->macros, sizeof(weave_macro_t*) * preprocessor->cap_macros);
     }
 
-    preprocessor->macro_names[preprocessor->num_macros] = macro_name;
-    preprocessor->macros[preprocessor->num_macros] = malloc(sizeof(weave_macro_t));
+    preprocessor->macros[preprocessor->num_macros++] = macro;
 
-    weave_macro_t* macro = preprocessor->macros[preprocessor->num_macros];
+    // keep the table at most half full
+    if (preprocessor->num_macros * 2 > preprocessor->macro_slot_cap) {
+        preprocessor->macro_slot_cap *= 2;
+        preprocessor->macro_slots =
+            weave_arena_alloc(arena, sizeof(u32) * preprocessor->macro_slot_cap);
+        memset(preprocessor->macro_slots, 0, sizeof(u32) * preprocessor->macro_slot_cap);
 
-    macro->arg_names = malloc(sizeof(char*) * 8);
-    macro->len_args = 0;
-    macro->cap_args = 8;
-    macro->tokens = malloc(sizeof(weave_token_t) * 8);
-    macro->cap_tokens = 8;
-    macro->len_tokens = 0;
+        for (usize i = 0; i < preprocessor->num_macros; i++) {
+            usize slot = preprocessor->macros[i]->hash & (preprocessor->macro_slot_cap - 1);
+
+            while (preprocessor->macro_slots[slot] != 0) {
+                slot = (slot + 1) & (preprocessor->macro_slot_cap - 1);
+            }
 
-    lexer_result = weave_lexer_next(preprocessor->lexer);
+            preprocessor->macro_slots[slot] = (u32)(i + 1);
+        }
+    } else {
+        usize slot = weave_preprocessor_find_macro_slot(
+            preprocessor,
+            macro->name,
+            strlen(macro->name),
+            macro->hash
+        );
+        preprocessor->macro_slots[slot] = (u32)preprocessor->num_macros;
+    }
+}
+
+static weave_token_t weave_preprocessor_lex_macro_token(weave_preprocessor_t* preprocessor) {
+    weave_lexer_result_t lexer_result = weave_lexer_next(preprocessor->lexer);
 
     if (!lexer_result.is_ok) {
-        LOG_ERROR(
-            "lexer error registering macro at %d:%d: %s\n",
+        weave_context_abort(
+            preprocessor->context,
             preprocessor->lexer->line,
             preprocessor->lexer->col,
+            "%s while registering macro",
             weave_lexer_error_str(lexer_result.err)
         );
-        exit(1);
     }
 
-    weave_token_t token = lexer_result.ok;
+    return lexer_result.ok;
+}
 
-    while (token.ty == WEAVE_TOKEN_IDENTIFIER) {
-        char* arg_name_raw = token.val.str_val.val;
-        u16 arg_name_len = token.val.str_val.len;
+static void weave_preprocessor_register_macro(weave_preprocessor_t* preprocessor) {
+    weave_token_t name_token = weave_preprocessor_lex_macro_token(preprocessor);
+
+    if (name_token.ty != WEAVE_TOKEN_IDENTIFIER) {
+        weave_context_abort(
+            preprocessor->context,
+            name_token.pos.line,
+            name_token.pos.col,
+            "expected macro name, got %s",
+            weave_token_ty_str(name_token.ty)
+        );
+    }
 
-        char* arg_name = malloc(sizeof(char) * (arg_name_len + 1));
-        memcpy(arg_name, arg_name_raw, arg_name_len);
-        arg_name[arg_name_len] = '\0';
+    char* macro_name_raw = name_token.val.str_val.val;
+    u16 macro_name_len = name_token.val.str_val.len;
+
+    if (weave_preprocessor_find_macro(preprocessor, macro_name_raw, macro_name_len) != NULL) {
+        weave_context_abort(
+            preprocessor->context,
+            name_token.pos.line,
+            name_token.pos.col,
+            "macro redefinition of '%s'",
+            macro_name_raw
+        );
+    }
 
-        weave_token_free(&token);
+    weave_arena_t* arena = preprocessor->context->arena;
+    weave_macro_t* macro = weave_arena_alloc(arena, sizeof(weave_macro_t));
 
-        if (macro->len_args == macro->cap_args) {
-            macro->cap_args *= 2;
-            macro->arg_names = realloc(macro->arg_names, sizeof(char*) * macro->cap_args);
-        }
+    // token strings are NUL-terminated and live as long as the macro
+    macro->name = macro_name_raw;
+    macro->hash = weave_hash_str(macro_name_raw, macro_name_len);
 
-        macro->arg_names[macro->len_args] = arg_name;
-        macro->len_args++;
+    macro->arg_names = weave_arena_alloc(arena, sizeof(char*) * 8);
+    macro->len_args = 0;
+    macro->cap_args = 8;
+    macro->tokens = weave_arena_alloc(arena, sizeof(weave_macro_token_t) * 8);
+    macro->cap_tokens = 8;
+    macro->len_tokens = 0;
 
-        lexer_result = weave_lexer_next(preprocessor->lexer);
+    weave_token_t token = weave_preprocessor_lex_macro_token(preprocessor);
 
-        if (!lexer_result.is_ok) {
-            LOG_ERROR(
-                "lexer error registering macro at %d:%d: %s\n",
-                preprocessor->lexer->line,
-                preprocessor->lexer->col,
-                weave_lexer_error_str(lexer_result.err)
+    while (token.ty == WEAVE_TOKEN_IDENTIFIER) {
+        if (macro->len_args == macro->cap_args) {
+            macro->arg_names = weave_arena_grow(
+                arena,
+                macro->arg_names,
+                sizeof(char*) * macro->cap_args,
+                sizeof(char*) * macro->cap_args * 2
             );
-            exit(1);
+            macro->cap_args *= 2;
         }
 
-        token = lexer_result.ok;
-    }
+        macro->arg_names[macro->len_args] = token.val.str_val.val;
+        macro->len_args++;
 
-    if (token.ty != WEAVE_TOKEN_COLON) {
-        LOG_ERROR(
-            "expected ':' after macro arguments at %d:%d\n",
-            preprocessor->lexer->line,
-            preprocessor->lexer->col
-        );
-        exit(1);
+        token = weave_preprocessor_lex_macro_token(preprocessor);
     }
 
-    lexer_result = weave_lexer_next(preprocessor->lexer);
-
-    if (!lexer_result.is_ok) {
-        LOG_ERROR(
-            "lexer error registering macro at %d:%d: %s\n",
+    if (token.ty != WEAVE_TOKEN_COLON) {
+        weave_context_abort(
+            preprocessor->context,
             preprocessor->lexer->line,
             preprocessor->lexer->col,
-            weave_lexer_error_str(lexer_result.err)
+            "expected ':' after macro arguments"
         );
-        exit(1);
     }
 
-    token = lexer_result.ok;
+    token = weave_preprocessor_lex_macro_token(preprocessor);
 
     while (token.ty != WEAVE_TOKEN_SEMICOLON) {
+        if (token.ty == WEAVE_TOKEN_EOF) {
+            weave_context_abort(
+                preprocessor->context,
+                preprocessor->lexer->line,
+                preprocessor->lexer->col,
+                "unexpected EOF while registering macro"
+            );
+        }
+
         if (macro->len_tokens == macro->cap_tokens) {
+            macro->tokens = weave_arena_grow(
+                arena,
+                macro->tokens,
+                sizeof(weave_macro_token_t) * macro->cap_tokens,
+                sizeof(weave_macro_token_t) * macro->cap_tokens * 2
+            );
             macro->cap_tokens *= 2;
-            macro->tokens = realloc(macro->tokens, sizeof(weave_token_t) * macro->cap_tokens);
         }
 
-        macro->tokens[macro->len_tokens] = token;
+        weave_macro_token_t* macro_token = &macro->tokens[macro->len_tokens];
         macro->len_tokens++;
 
-        lexer_result = weave_lexer_next(preprocessor->lexer);
+        if (token.ty != WEAVE_TOKEN_DOLLAR) {
+            macro_token->token = token;
+            macro_token->arg = WEAVE_MACRO_NO_ARG;
 
-        if (!lexer_result.is_ok) {
-            LOG_ERROR(
-                "lexer error registering macro at %d:%d: %s\n",
-                preprocessor->lexer->line,
-                preprocessor->lexer->col,
-                weave_lexer_error_str(lexer_result.err)
-            );
-            exit(1);
+            token = weave_preprocessor_lex_macro_token(preprocessor);
+            continue;
         }
 
-        token = lexer_result.ok;
+        // resolve `$arg` to the index of the argument
+        token = weave_preprocessor_lex_macro_token(preprocessor);
 
-        if (token.ty == WEAVE_TOKEN_EOF) {
-            LOG_ERROR(
-                "unexpected EOF while registering macro at %d:%d\n",
+        if (token.ty != WEAVE_TOKEN_IDENTIFIER) {
+            weave_context_abort(
+                preprocessor->context,
                 preprocessor->lexer->line,
-                preprocessor->lexer->col
+                preprocessor->lexer->col,
+                "expected identifier after '$' in macro definition"
             );
-            exit(1);
         }
-    }
 
-    preprocessor->num_macros++;
+        macro_token->arg = WEAVE_MACRO_NO_ARG;
 
-    if (token.ty == WEAVE_TOKEN_SEMICOLON) {
-        lexer_result = weave_lexer_next(preprocessor->lexer);
+        for (usize i = 0; i < macro->len_args; i++) {
+            if (strncmp(macro->arg_names[i], token.val.str_val.val, token.val.str_val.len) ==
+                    0 &&
+                macro->arg_names[i][token.val.str_val.len] == '\0') {
+                macro_token->arg = i;
+                break;
+            }
+        }
 
-        if (!lexer_result.is_ok) {
-            LOG_ERROR(
-                "lexer error registering macro at %d:%d: %s\n",
+        if (macro_token->arg == WEAVE_MACRO_NO_ARG) {
+            weave_context_abort(
+                preprocessor->context,
                 preprocessor->lexer->line,
                 preprocessor->lexer->col,
-                weave_lexer_error_str(lexer_result.err)
+                "unknown macro argument '%.*s' in macro definition",
+                (int)token.val.str_val.len,
+                token.val.str_val.val
             );
-            exit(1);
         }
-    } else {
-        LOG_ERROR(
-            "expected ';' after macro definition at %d:%d\n",
-            preprocessor->lexer->line,
-            preprocessor->lexer->col
-        );
-        exit(1);
+
+        token = weave_preprocessor_lex_macro_token(preprocessor);
     }
+
+    weave_preprocessor_add_macro(preprocessor, macro);
+
+    // the token after the ';' is skipped
+    weave_preprocessor_lex_macro_token(preprocessor);
+}
+
+static void weave_preprocessor_end_macro_invocation(weave_preprocessor_t* preprocessor) {
+    preprocessor->current_macro = NULL;
+    preprocessor->current_macro_token_index = 0;
+    preprocessor->current_macro_arg_index = 0;
+    preprocessor->current_macro_arg_expansion_index = 0;
+    preprocessor->in_macro_arg_expansion = false;
 }
 
+// returns the next token of the current macro's body, with arguments substituted
 static weave_token_t
 weave_preprocessor_step_current_macro_invocation(weave_preprocessor_t* preprocessor) {
     weave_macro_t* macro = preprocessor->current_macro;
 
-    if (preprocessor->in_macro_arg_expansion) {
-        weave_token_t token_to_return = weave_token_clone(
-            &preprocessor->current_macro_args[preprocessor->current_macro_arg_index]
-                 .arg_tokens[preprocessor->current_macro_arg_expansion_index]
-        );
+    while (true) {
+        if (preprocessor->in_macro_arg_expansion) {
+            usize arg_index = preprocessor->current_macro_arg_index;
+            usize expansion_index = preprocessor->current_macro_arg_expansion_index;
 
-        preprocessor->current_macro_arg_expansion_index++;
+            if (expansion_index < preprocessor->current_macro_args[arg_index].arg_token_len) {
+                preprocessor->current_macro_arg_expansion_index++;
 
-        if (preprocessor->current_macro_arg_expansion_index ==
-            preprocessor->current_macro_args[preprocessor->current_macro_arg_index]
-                .arg_token_len) {
-            preprocessor->current_macro_arg_expansion_index = 0;
-            preprocessor->current_macro_arg_index = 0;
-            preprocessor->in_macro_arg_expansion = false;
+                return preprocessor->current_macro_args[arg_index].arg_tokens[expansion_index];
+            }
 
+            preprocessor->in_macro_arg_expansion = false;
             preprocessor->current_macro_token_index++;
         }
 
-        return token_to_return;
-    }
-
-    if (preprocessor->current_macro_token_index == macro->len_tokens) {
-        for (u32 i = 0; i < preprocessor->current_macro->len_args; i++) {
-            for (u32 j = 0; j < preprocessor->current_macro_args[i].arg_token_len; j++) {
-                weave_token_free(&preprocessor->current_macro_args[i].arg_tokens[j]);
-            }
-            free(preprocessor->current_macro_args[i].arg_tokens);
-        }
-        free(preprocessor->current_macro_args);
-
-        preprocessor->current_macro = NULL;
-        preprocessor->current_macro_token_index = 0;
-        preprocessor->current_macro_arg_index = 0;
-        preprocessor->current_macro_arg_expansion_index = 0;
-        preprocessor->in_macro_arg_expansion = false;
-
-        return preprocessor->current_lexer_token;
-    }
-
-    weave_token_t token =
-        weave_token_clone(&macro->tokens[preprocessor->current_macro_token_index]);
-    preprocessor->current_macro_token_index++;
-
-    if (token.ty == WEAVE_TOKEN_DOLLAR) {
-        token = macro->tokens[preprocessor->current_macro_token_index];
+        if (preprocessor->current_macro_token_index == macro->len_tokens) {
+            weave_preprocessor_end_macro_invocation(preprocessor);
 
-        if (token.ty != WEAVE_TOKEN_IDENTIFIER) {
-            LOG_ERROR(
-                "expected identifier after '$' in macro invocation at %d:%d\n",
-                preprocessor->lexer->line,
-                preprocessor->lexer->col
-            );
-            exit(1);
+            return preprocessor->current_lexer_token;
         }
 
-        char* arg_name_raw = token.val.str_val.val;
-        u16 arg_name_len = token.val.str_val.len;
+        weave_macro_token_t* macro_token =
+            &macro->tokens[preprocessor->current_macro_token_index];
 
-        char* arg_name = malloc(sizeof(char) * (arg_name_len + 1));
-        memcpy(arg_name, arg_name_raw, arg_name_len);
-        arg_name[arg_name_len] = '\0';
-
-        bool found_arg = false;
-        usize arg_index = 0;
-
-        for (usize i = 0; i < macro->len_args; i++) {
-            if (strcmp(arg_name, macro->arg_names[i]) == 0) {
-                found_arg = true;
-                arg_index = i;
-                break;
-            }
-        }
+        if (macro_token->arg == WEAVE_MACRO_NO_ARG) {
+            preprocessor->current_macro_token_index++;
 
-        if (!found_arg) {
-            LOG_ERROR(
-                "unknown macro argument '%s' in macro invocation at %d:%d\n",
-                arg_name,
-                preprocessor->lexer->line,
-                preprocessor->lexer->col
-            );
-            exit(1);
+            return macro_token->token;
         }
 
-        free(arg_name);
-
-        preprocessor->current_macro_arg_index = arg_index;
+        preprocessor->current_macro_arg_index = macro_token->arg;
         preprocessor->current_macro_arg_expansion_index = 0;
         preprocessor->in_macro_arg_expansion = true;
-
-        return weave_preprocessor_step_current_macro_invocation(preprocessor);
     }
-
-    return token;
 }
 
 weave_token_t weave_preprocessor_next(weave_preprocessor_t* preprocessor) {
@@ -388,92 +383,107 @@ weave_token_t weave_preprocessor_next(weave_preprocessor_t* preprocessor) {
                 token = preprocessor->current_lexer_token;
                 break;
             default:
-                LOG_ERROR(
-                    "unknown preprocessor directive '%s' at %d:%d\n",
-                    token.val.str_val.val,
-                    preprocessor->lexer->line,
-                    preprocessor->lexer->col
+                weave_context_abort(
+                    preprocessor->context,
+                    token.pos.line,
+                    token.pos.col,
+                    "unknown preprocessor directive '%s'",
+                    token.ty == WEAVE_TOKEN_IDENTIFIER ? token.val.str_val.val
+                                                       : weave_token_ty_str(token.ty)
                 );
-                exit(1);
         }
     }
 
-    if (token.ty == WEAVE_TOKEN_IDENTIFIER) {
-        weave_token_t token_to_free = token;
-        for (usize i = 0; i < preprocessor->num_macros; i++) {
-            if (strncmp(
-                    preprocessor->macro_names[i],
-                    token.val.str_val.val,
-                    token.val.str_val.len
-                ) == 0 &&
-                preprocessor->macro_names[i][token.val.str_val.len] == '\0') {
-                preprocessor->current_macro = preprocessor->macros[i];
-                preprocessor->current_macro_token_index = 0;
-                preprocessor->current_macro_arg_expansion_index = 0;
-                preprocessor->in_macro_arg_expansion = false;
-
-                preprocessor->current_macro_args = malloc(
-                    sizeof(*preprocessor->current_macro_args) *
-                    preprocessor->current_macro->len_args
+    if (token.ty != WEAVE_TOKEN_IDENTIFIER) {
+        return token;
+    }
+
+    weave_macro_t* macro = weave_preprocessor_find_macro(
+        preprocessor,
+        token.val.str_val.val,
+        token.val.str_val.len
+    );
+
+    if (macro == NULL) {
+        return token;
+    }
+
+    weave_arena_t* arena = preprocessor->context->arena;
+
+    preprocessor->current_macro = macro;
+    preprocessor->current_macro_token_index = 0;
+    preprocessor->current_macro_arg_expansion_index = 0;
+    preprocessor->in_macro_arg_expansion = false;
+
+    if (macro->len_args > preprocessor->current_macro_args_cap) {
+        usize old_cap = preprocessor->current_macro_args_cap;
+
+        preprocessor->current_macro_args = weave_arena_grow(
+            arena,
+            preprocessor->current_macro_args,
+            sizeof(*preprocessor->current_macro_args) * old_cap,
+            sizeof(*preprocessor->current_macro_args) * macro->len_args
+        );
+        preprocessor->current_macro_args_cap = macro->len_args;
+
+        for (usize j = old_cap; j < macro->len_args; j++) {
+            preprocessor->current_macro_args[j].arg_tokens = NULL;
+            preprocessor->current_macro_args[j].arg_token_cap = 0;
+        }
+    }
+
+    weave_preprocessor_advance(preprocessor);
+
+    token = preprocessor->current_lexer_token;
+
+    // store macro invocation args
+    for (usize j = 0; j < macro->len_args; j++) {
+        preprocessor->current_macro_args[j].arg_token_len = 0;
+
+        // the invocation also ends at the end of the source, when it has no newline
+        while (token.ty != WEAVE_TOKEN_COMMA && token.ty != WEAVE_TOKEN_NEWLINE &&
+               token.ty != WEAVE_TOKEN_EOF) {
+            if (preprocessor->current_macro_args[j].arg_token_len ==
+                preprocessor->current_macro_args[j].arg_token_cap) {
+                usize cap = preprocessor->current_macro_args[j].arg_token_cap;
+
+                preprocessor->current_macro_args[j].arg_tokens = weave_arena_grow(
+                    arena,
+                    preprocessor->current_macro_args[j].arg_tokens,
+                    sizeof(weave_token_t) * cap,
+                    sizeof(weave_token_t) * (cap == 0 ? 1 : cap * 2)
                 );
+                preprocessor->current_macro_args[j].arg_token_cap = cap == 0 ? 1 : cap * 2;
+            }
 
-                weave_preprocessor_advance(preprocessor);
+            preprocessor->current_macro_args[j]
+                .arg_tokens[preprocessor->current_macro_args[j].arg_token_len] = token;
 
-                token = preprocessor->current_lexer_token;
+            preprocessor->current_macro_args[j].arg_token_len++;
+
+            weave_preprocessor_advance(preprocessor);
+
+            token = preprocessor->current_lexer_token;
+        }
 
-                // store macro invocation args
-                for (usize j = 0; j < preprocessor->current_macro->len_args; j++) {
-                    preprocessor->current_macro_args[j].arg_tokens =
-                        malloc(sizeof(weave_token_t));
-                    preprocessor->current_macro_args[j].arg_token_len = 0;
-                    preprocessor->current_macro_args[j].arg_token_cap = 1;
-
-                    while (token.ty != WEAVE_TOKEN_COMMA && token.ty != WEAVE_TOKEN_NEWLINE) {
-                        if (preprocessor->current_macro_args[j].arg_token_len ==
-                            preprocessor->current_macro_args[j].arg_token_cap) {
-                            preprocessor->current_macro_args[j].arg_token_cap *= 2;
-                            preprocessor->current_macro_args[j].arg_tokens = realloc(
-                                preprocessor->current_macro_args[j].arg_tokens,
-                                sizeof(weave_token_t) *
-                                    preprocessor->current_macro_args[j].arg_token_cap
-                            );
-                        }
-
-                        preprocessor->current_macro_args[j]
-                            .arg_tokens[preprocessor->current_macro_args[j].arg_token_len] =
-                            token;
-
-                        preprocessor->current_macro_args[j].arg_token_len++;
-
-                        weave_preprocessor_advance(preprocessor);
-
-                        token = preprocessor->current_lexer_token;
-                    }
-
-                    if (token.ty == WEAVE_TOKEN_NEWLINE) {
-                        if (j < preprocessor->current_macro->len_args - 1) {
-                            LOG_ERROR(
-                                "expected more arguments to macro '%s' at %d:%d\n",
-                                preprocessor->macro_names[i],
-                                preprocessor->lexer->line,
-                                preprocessor->lexer->col
-                            );
-                            exit(1);
-                        } else {
-                            break;
-                        }
-                    } else if (token.ty == WEAVE_TOKEN_COMMA) {
-                        weave_preprocessor_advance(preprocessor);
-
-                        token = preprocessor->current_lexer_token;
-                    }
-                }
-
-                weave_token_free(&token_to_free);
-                return weave_preprocessor_step_current_macro_invocation(preprocessor);
+        if (token.ty == WEAVE_TOKEN_NEWLINE || token.ty == WEAVE_TOKEN_EOF) {
+            if (j < macro->len_args - 1) {
+                weave_context_abort(
+                    preprocessor->context,
+                    preprocessor->lexer->line,
+                    preprocessor->lexer->col,
+                    "expected more arguments to macro '%s'",
+                    macro->name
+                );
+            } else {
+                break;
             }
+        } else if (token.ty == WEAVE_TOKEN_COMMA) {
+            weave_preprocessor_advance(preprocessor);
+
+            token = preprocessor->current_lexer_token;
         }
     }
 
-    return token;
+    return weave_preprocessor_step_current_macro_invocation(preprocessor);
 }
@@ -1,25 +1,39 @@
 #include "weave.h"
+#include "arena.h"
 #include "burrow.h"
+#include "context.h"
+#include "labels.h"
 #include "preprocessor.h"
 #include "weave.h"
 #include "lexer.h"
 #include "log.h"
 #include "types.h"
 
+#include <setjmp.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+#define WEAVE_IMAGE_INITIAL_CAP 0x1000
+
+// size of the chunks `weave_process` reads its input in
+#define WEAVE_INPUT_CHUNK_SIZE 0x4000
+
 static void weave_advance(weave_t* weave);
 static bool weave_match_token_type(weave_t* weave, weave_token_ty_t ty);
 static void weave_consume_token_type(weave_t* weave, weave_token_ty_t ty);
 
-static weave_t* weave_new(weave_preprocessor_t* preprocessor, FILE* output) {
-    weave_t* weave = malloc(sizeof(weave_t));
+static weave_t* weave_new(weave_context_t* context, weave_preprocessor_t* preprocessor) {
+    weave_t* weave = weave_arena_alloc(context->arena, sizeof(weave_t));
+    weave->context = context;
     weave->preprocessor = preprocessor;
-    weave->output = output;
 
-    weave->num_labels = 0;
+    weave->labels = weave_labels_new(context);
+
+    weave->image_cap = WEAVE_IMAGE_INITIAL_CAP;
+    weave->image_len = 0;
+    weave->image = weave_arena_alloc(context->arena, weave->image_cap);
+
     weave->addr = 0;
     weave->at_eof = false;
     weave->token.ty = WEAVE_TOKEN_INVALID;
@@ -29,121 +43,57 @@ static weave_t* weave_new(weave_preprocessor_t* preprocessor, FILE* output) {
     return weave;
 }
 
-static void weave_free(weave_t* weave) {
-    for (size_t i = 0; i < weave->num_labels; i++) {
-        free(weave->labels[i].name);
-        if (weave->labels[i].unresolved_refs) {
-            free(weave->labels[i].unresolved_refs);
-        }
-    }
-    weave_token_free(&weave->token);
-    weave_preprocessor_free(weave->preprocessor);
-    free(weave);
-}
-
 static void weave_emit_instruction(weave_t* weave, burrow_op_t op) {
-    fputc(op.op, weave->output);
-    weave->addr++;
-    fputc(op.regs.dest, weave->output);
-    weave->addr++;
-    fputc(op.regs.src_a, weave->output);
-    weave->addr++;
-    fputc(op.regs.src_b, weave->output);
-    weave->addr++;
-}
-
-static void weave_register_label(weave_t* weave, const weave_token_t* label) {
-    if (weave->num_labels == WEAVE_MAX_LABELS) {
-        LOG_ERROR(
-            "internal error at %d:%d: Too many labels\n",
-            label->pos.line,
-            label->pos.col
+    if (weave->image_len + 4 > weave->image_cap) {
+        weave->image = weave_arena_grow(
+            weave->context->arena,
+            weave->image,
+            weave->image_cap,
+            weave->image_cap * 2
         );
-        exit(1);
-    }
-
-    for (size_t i = 0; i < weave->num_labels; i++) {
-        if (strlen(weave->labels[i].name) == label->val.str_val.len &&
-            memcmp(weave->labels[i].name, label->val.str_val.val, label->val.str_val.len) ==
-                0) {
-            if (weave->labels[i].defined) {
-                LOG_ERROR(
-                    "internal error at %d:%d: Label '%.*s' already defined\n",
-                    label->pos.line,
-                    label->pos.col,
-                    label->val.str_val.len,
-                    label->val.str_val.val
-                );
-                exit(1);
-            } else {
-                weave->labels[i].defined = true;
-                weave->labels[i].addr = weave->addr;
-            }
-        }
+        weave->image_cap *= 2;
     }
 
-    weave_label_t* new_label = &weave->labels[weave->num_labels++];
-
-    new_label->defined = true;
-    new_label->unresolved_refs = NULL;
-    new_label->unresolved_refs_len = 0;
-    new_label->unresolved_refs_cap = 0;
+    u8* bytes = weave->image + weave->image_len;
 
-    new_label->name = malloc(label->val.str_val.len + 1);
-    memcpy(new_label->name, label->val.str_val.val, label->val.str_val.len);
-    new_label->name[label->val.str_val.len] = '\0';
+    bytes[0] = op.op;
+    bytes[1] = op.regs.dest;
+    bytes[2] = op.regs.src_a;
+    bytes[3] = op.regs.src_b;
 
-    new_label->addr = weave->addr;
+    weave->image_len += 4;
+    weave->addr += 4;
 }
 
-static u16
-weave_get_label_value(weave_t* weave, const char* label_name, size_t label_name_len) {
-    for (size_t i = 0; i < weave->num_labels; i++) {
-        if (strlen(weave->labels[i].name) == label_name_len &&
-            memcmp(weave->labels[i].name, label_name, label_name_len) == 0) {
-            // check if label is defined
-            if (!weave->labels[i].defined) {
-                // add to unresolved_refs
-                if (weave->labels[i].unresolved_refs_len ==
-                    weave->labels[i].unresolved_refs_cap) {
-                    weave->labels[i].unresolved_refs_cap =
-                        weave->labels[i].unresolved_refs_cap == 0
-                            ? 1
-                            : weave->labels[i].unresolved_refs_cap * 2;
-                    weave->labels[i].unresolved_refs = realloc(
-                        weave->labels[i].unresolved_refs,
-                        sizeof(u16) * weave->labels[i].unresolved_refs_cap
-                    );
-                }
-
-                weave->labels[i].unresolved_refs[weave->labels[i].unresolved_refs_len++] =
-                    weave->addr;
-
-                return 0;
-            } else {
-                return weave->labels[i].addr;
-            }
-        }
-    }
+static void weave_register_label(weave_t* weave, const weave_token_t* label) {
+    weave_label_t* entry =
+        weave_labels_get(weave->labels, label->val.str_val.val, label->val.str_val.len);
 
-    // not found, register new label as unresolved
-    if (weave->num_labels == WEAVE_MAX_LABELS) {
-        LOG_ERROR("internal error: Too many labels\n");
-        exit(1);
+    if (entry->defined) {
+        weave_context_abort(
+            weave->context,
+            label->pos.line,
+            label->pos.col,
+            "Label '%.*s' already defined",
+            (int)label->val.str_val.len,
+            label->val.str_val.val
+        );
     }
 
-    weave_label_t* new_label = &weave->labels[weave->num_labels++];
+    entry->defined = true;
+    entry->addr = weave->addr;
+}
 
-    new_label->defined = false;
-    new_label->unresolved_refs = malloc(sizeof(u16) * 4);
-    new_label->unresolved_refs_len = 1;
-    new_label->unresolved_refs_cap = 4;
+static u16 weave_get_label_value(weave_t* weave, const char* label_name, u16 label_name_len) {
+    weave_label_t* label = weave_labels_get(weave->labels, label_name, label_name_len);
 
-    new_label->name = malloc(label_name_len + 1);
-    memcpy(new_label->name, label_name, label_name_len);
-    new_label->name[label_name_len] = '\0';
+    if (label->defined) {
+        return label->addr;
+    }
 
-    new_label->unresolved_refs[0] = weave->addr + 2; // labels will always be in immediate
+    // not defined yet, patched once the whole program is assembled. labels will always be in
+    // immediate
+    weave_label_add_ref(weave->labels, label, weave->addr + 2);
 
     return 0;
 }
@@ -257,26 +207,26 @@ static u8 weave_parse_register(weave_t* weave) {
     weave_consume_token_type(weave, WEAVE_TOKEN_PERCENT);
 
     if (weave->token.ty != WEAVE_TOKEN_IDENTIFIER) {
-        LOG_ERROR(
-            "parser error at %d:%d: Expected identifier after %%\n",
+        weave_context_abort(
+            weave->context,
             weave->token.pos.line,
-            weave->token.pos.col
+            weave->token.pos.col,
+            "Expected identifier after %%"
         );
-        exit(1);
     }
 
     u8 reg =
         burrow_register_from_str(weave->token.val.str_val.val, weave->token.val.str_val.len);
 
     if (reg == BURROW_REG_INVALID) {
-        LOG_ERROR(
-            "parser error at %d:%d: Invalid register %%%.*s\n",
+        weave_context_abort(
+            weave->context,
             weave->token.pos.line,
             weave->token.pos.col,
+            "Invalid register %%%.*s",
             (int)weave->token.val.str_val.len,
             weave->token.val.str_val.val
         );
-        exit(1);
     }
 
     weave_advance(weave);
@@ -299,12 +249,12 @@ static u16 weave_parse_immediate(weave_t* weave) {
         case WEAVE_TOKEN_DOT: {
             weave_advance(weave);
             if (weave->token.ty != WEAVE_TOKEN_IDENTIFIER) {
-                LOG_ERROR(
-                    "parser error at %d:%d: Expected identifier after .\n",
+                weave_context_abort(
+                    weave->context,
                     weave->token.pos.line,
-                    weave->token.pos.col
+                    weave->token.pos.col,
+                    "Expected identifier after ."
                 );
-                exit(1);
             }
 
             u16 addr = weave_get_label_value(
@@ -321,12 +271,12 @@ static u16 weave_parse_immediate(weave_t* weave) {
             break;
     }
 
-    LOG_ERROR(
-        "parser error at %d:%d: Expected immediate\n",
+    weave_context_abort(
+        weave->context,
         weave->token.pos.line,
-        weave->token.pos.col
+        weave->token.pos.col,
+        "Expected immediate"
     );
-    exit(1);
 }
 
 static u8 weave_op_from_str(const char* str, size_t len) {
@@ -343,25 +293,25 @@ static void weave_parse_instruction(weave_t* weave) {
     burrow_op_t op = { 0 };
 
     if (weave->token.ty != WEAVE_TOKEN_IDENTIFIER) {
-        LOG_ERROR(
-            "parser error at %d:%d: Expected identifier\n",
+        weave_context_abort(
+            weave->context,
             weave->token.pos.line,
-            weave->token.pos.col
+            weave->token.pos.col,
+            "Expected identifier"
         );
-        exit(1);
     }
 
     op.op = weave_op_from_str(weave->token.val.str_val.val, weave->token.val.str_val.len);
 
     if (op.op == BURROW_OP_INVALID) {
-        LOG_ERROR(
-            "parser error at %d:%d: Invalid instruction %.*s\n",
+        weave_context_abort(
+            weave->context,
             weave->token.pos.line,
             weave->token.pos.col,
+            "Invalid instruction %.*s",
             (int)weave->token.val.str_val.len,
             weave->token.val.str_val.val
         );
-        exit(1);
     }
 
     weave_advance(weave);
@@ -425,63 +375,217 @@ static void weave_run(weave_t* weave) {
                 weave_register_label(weave, &weave->token);
                 weave_advance(weave);
             } else {
-                LOG_ERROR(
-                    "parser error at %d:%d: Expected identifier after dot\n",
+                weave_context_abort(
+                    weave->context,
                     weave->token.pos.line,
-                    weave->token.pos.col
+                    weave->token.pos.col,
+                    "Expected identifier after dot"
                 );
-                exit(1);
             }
             weave_consume_token_type(weave, WEAVE_TOKEN_COLON);
         } else if (weave->token.ty == WEAVE_TOKEN_IDENTIFIER) {
             // instruction
             weave_parse_instruction(weave);
         } else {
-            LOG_ERROR(
-                "parser error at %d:%d: Expected instruction or label, got %s\n",
+            weave_context_abort(
+                weave->context,
                 weave->token.pos.line,
                 weave->token.pos.col,
+                "Expected instruction or label, got %s",
                 weave_token_ty_str(weave->token.ty)
             );
-            exit(1);
         }
     }
 
     // backpatch labels
-    for (size_t i = 0; i < weave->num_labels; i++) {
-        weave_label_t* label = &weave->labels[i];
+    for (size_t i = 0; i < weave->labels->len; i++) {
+        weave_label_t* label = &weave->labels->labels[i];
         if (!label->defined) {
-            LOG_ERROR("error: Label %s not found\n", label->name);
+            // reported without stopping, so every missing label shows up at once
+            weave_context_report(weave->context, 0, 0, "Label %s not found", label->name);
         } else {
             for (size_t j = 0; j < label->unresolved_refs_len; j++) {
                 u16 addr = label->unresolved_refs[j];
-                usize addr_full = (usize)addr;
-
-#ifdef _WIN32
-                fseek(weave->output, addr_full + 1, SEEK_SET);
-#else
-                fseek(weave->output, addr_full, SEEK_SET);
-#endif
-                u8 low_byte = label->addr & 0xFF;
-                u8 high_byte = (label->addr >> 8) & 0xFF;
-                // write high byte first
-                fwrite(&high_byte, 1, 1, weave->output);
-                fwrite(&low_byte, 1, 1, weave->output);
+
+                // high byte first
+                weave->image[addr] = (label->addr >> 8) & 0xFF;
+                weave->image[addr + 1] = label->addr & 0xFF;
             }
         }
     }
 }
 
+// copies `size` bytes out of the arena into memory owned by the result
+static void* weave_result_copy(const void* data, usize size) {
+    // malloc(0) may return NULL, which would read as a failed assembly
+    void* copy = malloc(size == 0 ? 1 : size);
+
+    if (copy == NULL) {
+        LOG_ERROR("internal error: Failed to allocate memory for result\n");
+        exit(1);
+    }
+
+    if (size > 0) {
+        memcpy(copy, data, size);
+    }
+
+    return copy;
+}
+
+// the defined labels go into a single allocation, their names after the symbols
+static void weave_result_take_symbols(weave_result_t* result, const weave_labels_t* labels) {
+    usize symbol_count = 0;
+    usize names_size = 0;
+
+    for (usize i = 0; i < labels->len; i++) {
+        if (labels->labels[i].defined) {
+            symbol_count++;
+            names_size += labels->labels[i].name_len + 1;
+        }
+    }
+
+    usize symbols_size = sizeof(weave_symbol_t) * symbol_count;
+    weave_symbol_t* symbols = malloc(symbols_size + names_size);
+
+    if (symbols == NULL) {
+        LOG_ERROR("internal error: Failed to allocate memory for result\n");
+        exit(1);
+    }
+
+    char* names = (char*)symbols + symbols_size;
+    usize symbol = 0;
+
+    for (usize i = 0; i < labels->len; i++) {
+        const weave_label_t* label = &labels->labels[i];
+
+        if (!label->defined) {
+            continue;
+        }
+
+        memcpy(names, label->name, label->name_len + 1);
+        symbols[symbol].name = names;
+        symbols[symbol].addr = label->addr;
+
+        names += label->name_len + 1;
+        symbol++;
+    }
+
+    result->symbols = symbols;
+    result->symbol_count = symbol_count;
+}
+
+// assembles `len` bytes of source. errors don't stop the host, they are returned as
+// diagnostics. returns whether the program assembled without errors, the result has to be
+// freed either way.
+bool weave_assemble_buffer(const char* src, usize len, weave_result_t* out) {
+    *out = (weave_result_t){ 0 };
+
+    weave_context_t* context = weave_context_new();
+
+    if (setjmp(context->abort) == 0) {
+        weave_lexer_t* lexer = weave_lexer_new(context, src, len);
+
+        weave_preprocessor_t* preprocessor = weave_preprocessor_new(context, lexer);
+
+        weave_t* weave = weave_new(context, preprocessor);
+
+        weave_run(weave);
+
+        out->image = weave_result_copy(weave->image, weave->image_len);
+        out->image_len = weave->image_len;
+
+        weave_result_take_symbols(out, weave->labels);
+    }
+
+    // an error that stopped assembly jumped here, and left no image behind
+    out->diagnostic_count = context->diagnostic_count;
+    out->diagnostics = weave_result_copy(
+        context->diagnostics,
+        sizeof(weave_diagnostic_t) * context->diagnostic_count
+    );
+    out->ok = out->image != NULL && out->diagnostic_count == 0;
+
+    // everything the stages allocated goes with the context
+    weave_context_free(context);
+
+    return out->ok;
+}
+
+void weave_result_free(weave_result_t* result) {
+    free(result->image);
+    free(result->symbols);
+    free(result->diagnostics);
+
+    *result = (weave_result_t){ 0 };
+}
+
+// reads all of `input`, which may be a pipe
+static char* weave_read_input(FILE* input, usize* len) {
+    usize cap = WEAVE_INPUT_CHUNK_SIZE;
+    char* src = malloc(cap);
+    *len = 0;
+
+    while (src != NULL) {
+        *len += fread(src + *len, 1, cap - *len, input);
+
+        if (*len < cap) {
+            break;
+        }
+
+        cap *= 2;
+        src = realloc(src, cap);
+    }
+
+    if (src == NULL) {
+        LOG_ERROR("internal error: Failed to allocate memory for input\n");
+        exit(1);
+    }
+
+    if (ferror(input)) {
+        LOG_ERROR("error: Failed to read input\n");
+        exit(1);
+    }
+
+    return src;
+}
+
 void weave_process(FILE* input, FILE* output) {
-    weave_lexer_t* lexer = weave_lexer_new(input);
+    usize len;
+    char* src = weave_read_input(input, &len);
 
-    weave_preprocessor_t* preprocessor = weave_preprocessor_new(lexer);
+    weave_result_t result;
+    weave_assemble_buffer(src, len, &result);
 
-    weave_t* weave = weave_new(preprocessor, output);
+    free(src);
 
-    weave_run(weave);
+    for (usize i = 0; i < result.diagnostic_count; i++) {
+        const weave_diagnostic_t* diagnostic = &result.diagnostics[i];
 
-    weave_free(weave);
+        if (diagnostic->line == 0) {
+            LOG_ERROR("error: %s\n", diagnostic->message);
+        } else {
+            LOG_ERROR(
+                "error at %u:%u: %s\n",
+                diagnostic->line,
+                diagnostic->col,
+                diagnostic->message
+            );
+        }
+    }
+
+    // missing labels still leave an image behind, with zeros in their place
+    if (result.image == NULL) {
+        exit(1);
+    }
+
+    // glibc hands a write this large straight to the OS, bypassing the stream buffer
+    if (fwrite(result.image, 1, result.image_len, output) != result.image_len ||
+        fflush(output) != 0) {
+        LOG_ERROR("error: Failed to write output\n");
+        exit(1);
+    }
+
+    weave_result_free(&result);
 }
 
 static void weave_print_token(weave_token_t token) {
@@ -524,10 +628,6 @@ static void weave_print_token(weave_token_t token) {
 }
 
 static void weave_advance(weave_t* weave) {
-    if (weave->token.ty != WEAVE_TOKEN_INVALID) {
-        weave_token_free(&weave->token);
-    }
-
     weave->token = weave_preprocessor_next(weave->preprocessor);
 
     // weave_print_token(weave->token);
@@ -537,14 +637,14 @@ static void weave_advance(weave_t* weave) {
 
 static void weave_consume_token_type(weave_t* weave, weave_token_ty_t ty) {
     if (weave->token.ty != ty) {
-        LOG_ERROR(
-            "lexer error at %d:%d: Expected token type %s, got %s\n",
+        weave_context_abort(
+            weave->context,
             weave->token.pos.line,
             weave->token.pos.col,
+            "Expected token type %s, got %s",
             weave_token_ty_str(ty),
             weave_token_ty_str(weave->token.ty)
         );
-        exit(1);
     }
 
     weave_advance(weave);